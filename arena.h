@@ -0,0 +1,96 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace qp {
+namespace rf {
+
+// Owns the nodes of a tree.  Nodes are placed one after another in large
+// blocks, in the order they are made, rather than each in its own heap
+// allocation, and are all destroyed together.  Nodes can be made from several
+// threads at once, as when a tree's subtrees are grown in parallel.
+template <typename NodeT>
+class NodeArena {
+ public:
+  NodeArena() = default;
+
+  // Arenas are moved along with their trees.  Neither arena may be in use.
+  NodeArena(NodeArena&& other) noexcept
+      : blocks_(std::move(other.blocks_)), size_(other.size_) {
+    other.size_ = 0;
+  }
+
+  NodeArena& operator=(NodeArena&& other) noexcept {
+    clear();
+    blocks_ = std::move(other.blocks_);
+    size_ = other.size_;
+    other.size_ = 0;
+    return *this;
+  }
+
+  ~NodeArena() { clear(); }
+
+  // Constructs a node from args and returns it.  It lives until the arena is
+  // cleared.
+  template <typename... Args>
+  NodeT* make(Args&&... args) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (blocks_.empty() || blocks_.back().used == blocks_.back().capacity) {
+      // Blocks double in size, so a tree of n nodes takes about log(n) of
+      // them.
+      const auto capacity =
+          blocks_.empty()
+              ? kFirstBlockNodes
+              : std::min(2 * blocks_.back().capacity, kMaxBlockNodes);
+      blocks_.push_back({std::make_unique<Slot[]>(capacity), capacity, 0});
+    }
+    auto& block = blocks_.back();
+    auto* node =
+        new (&block.slots[block.used]) NodeT(std::forward<Args>(args)...);
+    ++block.used;
+    ++size_;
+    return node;
+  }
+
+  // Destroys every node and frees the blocks holding them.
+  void clear() {
+    for (auto& block : blocks_) {
+      for (auto i = 0ul; i < block.used; ++i) {
+        std::launder(reinterpret_cast<NodeT*>(&block.slots[i]))->~NodeT();
+      }
+    }
+    blocks_.clear();
+    size_ = 0;
+  }
+
+  // The number of nodes made since the arena was last cleared.
+  std::size_t size() const { return size_; }
+
+ private:
+  using Slot = std::aligned_storage_t<sizeof(NodeT), alignof(NodeT)>;
+
+  struct Block {
+    std::unique_ptr<Slot[]> slots;
+    std::size_t capacity;
+    std::size_t used;
+  };
+
+  static constexpr std::size_t kFirstBlockNodes = 64;
+  static constexpr std::size_t kMaxBlockNodes = 1 << 16;
+
+  std::vector<Block> blocks_;
+  std::size_t size_ = 0;
+  std::mutex mu_;
+};
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* ARENA_H */
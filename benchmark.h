@@ -59,34 +59,31 @@ std::ostream& operator<<(std::ostream& os, const BenchmarkInfo& info) {
 }
 
 // Run the benchmarks and return the info struct.  The classifer type should
-// define train, and predict methods.
-template <typename Classifier>
+// define train, and predict_batch methods.
+template <typename Classifier, typename T>
 BenchmarkInfo benchmark(Classifier& classifier,
-                        const rf::DataSet& training_data,
-                        const rf::DataSet& testing_data) {
+                        const rf::DataSet<T>& training_data,
+                        const rf::DataSet<T>& testing_data) {
   BenchmarkInfo ret;
   ret.training_time = time_op([&]() { classifier.train(training_data); });
-  ret.evaluation_time = 0;
 
-  const auto max_label =
-      std::max_element(training_data.begin(), training_data.end(),
-                       [](const auto& lhs, const auto& rhs) {
-                         return lhs.label < rhs.label;
-                       })
-          ->label;
+  const auto max_label = *std::max_element(training_data.labels.begin(),
+                                           training_data.labels.end());
 
   std::vector<std::vector<int>> confusion_matrix(
       max_label + 1, std::vector<int>(max_label + 1, 0));
   int correctly_classified = 0;
 
-  for (const auto& example : testing_data) {
-    double predicted;
-    ret.evaluation_time +=
-        time_op([&]() { predicted = classifier.predict(example.features); });
-    if (predicted == example.label) {
+  std::vector<double> predictions;
+  ret.evaluation_time = time_op(
+      [&]() { predictions = classifier.predict_batch(testing_data); });
+  for (auto sample = 0ul; sample < testing_data.size(); ++sample) {
+    const auto label = testing_data.labels[sample];
+    const auto predicted = predictions[sample];
+    if (predicted == label) {
       ++correctly_classified;
     }
-    ++confusion_matrix[example.label][predicted];
+    ++confusion_matrix[label][predicted];
   }
 
   ret.confusion_matrix = std::move(confusion_matrix);
@@ -0,0 +1,313 @@
+#ifndef BINARY_DATASET_H
+#define BINARY_DATASET_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "csv.h"
+#include "dataset.h"
+#include "mapped_file.h"
+#include "threadpool.h"
+
+/*
+ * A compact binary format for datasets, so that they can be loaded by mapping
+ * the file instead of parsing text.  A file is laid out as:
+ *
+ *   header | padding | features | padding | labels
+ *
+ * where both blocks start on a kFeatureAlignment boundary.  The features are
+ * the raw contents of the FeatureMatrix, in the layout recorded in the header.
+ * Values are stored in the byte order of the machine that wrote them.
+ */
+
+namespace qp {
+namespace rf {
+
+// The type features are stored as.
+enum class DType : std::uint32_t { FLOAT64 = 1, FLOAT32 = 2, UINT8 = 3 };
+
+template <typename T>
+struct DTypeOf;
+
+template <>
+struct DTypeOf<double> {
+  static constexpr DType value = DType::FLOAT64;
+};
+
+template <>
+struct DTypeOf<float> {
+  static constexpr DType value = DType::FLOAT32;
+};
+
+template <>
+struct DTypeOf<std::uint8_t> {
+  static constexpr DType value = DType::UINT8;
+};
+
+// How labels are stored.  Currently they are always the original label
+// values stored as doubles.
+enum class LabelEncoding : std::uint32_t { FLOAT64 = 1 };
+
+struct BinaryDataSetHeader {
+  char magic[8];
+  std::uint32_t version;
+  DType dtype;
+  Layout layout;
+  LabelEncoding label_encoding;
+  std::uint64_t n_samples;
+  std::uint64_t n_features;
+  // Byte offsets of the blocks from the start of the file.
+  std::uint64_t features_offset;
+  std::uint64_t labels_offset;
+};
+
+constexpr char kBinaryDataSetMagic[8] = {'Q', 'P', 'R', 'F', 'D', 'S', 0, 0};
+constexpr std::uint32_t kBinaryDataSetVersion = 1;
+
+namespace {
+
+std::uint64_t align_up(std::uint64_t offset) {
+  return (offset + kFeatureAlignment - 1) / kFeatureAlignment *
+         kFeatureAlignment;
+}
+
+// Returns the modification time of the file, or -1 if it does not exist.
+std::int64_t modification_time(const std::string& path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) return -1;
+  return info.st_mtime;
+}
+
+// Whether bytes bytes starting at offset fit in a file of file_size bytes,
+// without the sum overflowing.
+bool fits_in_file(std::uint64_t offset, std::uint64_t bytes,
+                  std::uint64_t file_size) {
+  return offset <= file_size && bytes <= file_size - offset;
+}
+
+// Whether header describes a dataset of T which fits in a file of file_size
+// bytes.  The features and labels are used in place once the file is mapped,
+// so a corrupt or stale header must not place them out of bounds, or at an
+// offset misaligned for their type.
+template <typename T>
+bool valid_header(const BinaryDataSetHeader& header, std::uint64_t file_size) {
+  if (std::memcmp(header.magic, kBinaryDataSetMagic, sizeof(header.magic)) !=
+          0 ||
+      header.version != kBinaryDataSetVersion ||
+      header.dtype != DTypeOf<T>::value ||
+      (header.layout != Layout::ROW_MAJOR &&
+       header.layout != Layout::COLUMN_MAJOR) ||
+      header.label_encoding != LabelEncoding::FLOAT64) {
+    return false;
+  }
+
+  if (header.features_offset < sizeof(header) ||
+      header.labels_offset < sizeof(header) ||
+      header.features_offset % alignof(T) != 0 ||
+      header.labels_offset % alignof(double) != 0) {
+    return false;
+  }
+
+  const auto max_bytes = std::numeric_limits<std::uint64_t>::max();
+  if ((header.n_features != 0 &&
+       header.n_samples > max_bytes / sizeof(T) / header.n_features) ||
+      header.n_samples > max_bytes / sizeof(double)) {
+    return false;
+  }
+  const auto features_bytes = header.n_samples * header.n_features * sizeof(T);
+  const auto labels_bytes = header.n_samples * sizeof(double);
+  return fits_in_file(header.features_offset, features_bytes, file_size) &&
+         fits_in_file(header.labels_offset, labels_bytes, file_size);
+}
+
+}  // namespace
+
+// Writes the dataset to path in the binary format.  Returns false if the file
+// could not be written.
+template <typename T>
+bool write_binary_data_set(const DataSet<T>& data_set,
+                           const std::string& path) {
+  BinaryDataSetHeader header;
+  std::memcpy(header.magic, kBinaryDataSetMagic, sizeof(header.magic));
+  header.version = kBinaryDataSetVersion;
+  header.dtype = DTypeOf<T>::value;
+  header.layout = data_set.features.layout();
+  header.label_encoding = LabelEncoding::FLOAT64;
+  header.n_samples = data_set.size();
+  header.n_features = data_set.n_features();
+  header.features_offset = align_up(sizeof(header));
+  header.labels_offset = align_up(header.features_offset +
+                                  data_set.features.size() * sizeof(T));
+
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  const std::vector<char> padding(kFeatureAlignment, 0);
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(padding.data(), header.features_offset - sizeof(header));
+  os.write(reinterpret_cast<const char*>(data_set.features.data()),
+           data_set.features.size() * sizeof(T));
+  os.write(padding.data(), header.labels_offset - os.tellp());
+  os.write(reinterpret_cast<const char*>(data_set.labels.data()),
+           data_set.labels.size() * sizeof(double));
+  return static_cast<bool>(os);
+}
+
+// Loads a dataset written by write_binary_data_set.  The file is mapped copy
+// on write, and the features are used in place rather than copied, so
+// loading takes about as long as reading the header.  Changes to the features
+// stay private to the process.  Returns false if the file cannot be read, is
+// not a dataset, or stores features of a type other than T.
+template <typename T>
+bool read_binary_data_set(const std::string& path, DataSet<T>* data_set) {
+  auto file = std::make_shared<qp::io::MappedFile>(
+      path, qp::io::MapMode::COPY_ON_WRITE);
+  if (!*file || file->size() < sizeof(BinaryDataSetHeader)) return false;
+
+  BinaryDataSetHeader header;
+  std::memcpy(&header, file->begin(), sizeof(header));
+  if (!valid_header<T>(header, file->size())) return false;
+
+  auto* features = reinterpret_cast<T*>(file->data() + header.features_offset);
+  const auto* labels =
+      reinterpret_cast<const double*>(file->begin() + header.labels_offset);
+
+  // Labels are small next to the features, so they are copied.
+  data_set->labels.assign(labels, labels + header.n_samples);
+  data_set->features =
+      FeatureMatrix<T>(features, header.n_samples, header.n_features,
+                       header.layout, std::move(file));
+  return true;
+}
+
+// Reads samples from a file written by write_binary_data_set a chunk at a
+// time, for datasets too large to load at once.  Nothing is mapped, so only
+// the chunks being read take up memory.  This is the source used to train a
+// DecisionForest out of core.
+template <typename T>
+class BinaryDataSource {
+ public:
+  // Like a std::ifstream, the source converts to false if the file could not
+  // be opened or does not hold a dataset of T.
+  explicit BinaryDataSource(const std::string& path);
+
+  BinaryDataSource(const BinaryDataSource&) = delete;
+  BinaryDataSource& operator=(const BinaryDataSource&) = delete;
+
+  ~BinaryDataSource() {
+    if (fd_ >= 0) close(fd_);
+  }
+
+  explicit operator bool() const { return fd_ >= 0; }
+
+  // Number of samples in the file.
+  std::size_t size() const { return header_.n_samples; }
+
+  std::size_t n_features() const { return header_.n_features; }
+
+  // Reads the n samples starting at first into the first n rows of chunk,
+  // which must be row major and have room for them.  Returns false if the
+  // file could not be read.
+  bool read(std::size_t first, std::size_t n, DataSet<T>* chunk) const;
+
+ private:
+  // Reads bytes bytes at offset into out, retrying short reads.
+  bool read_at(void* out, std::size_t bytes, std::uint64_t offset) const;
+
+  int fd_ = -1;
+  BinaryDataSetHeader header_;
+  // Holds a run of one feature when reading column major files.
+  mutable std::vector<T> column_;
+};
+
+template <typename T>
+BinaryDataSource<T>::BinaryDataSource(const std::string& path) {
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) return;
+
+  struct stat info;
+  if (fstat(fd_, &info) != 0 || !read_at(&header_, sizeof(header_), 0) ||
+      !valid_header<T>(header_, info.st_size)) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+template <typename T>
+bool BinaryDataSource<T>::read(std::size_t first, std::size_t n,
+                               DataSet<T>* chunk) const {
+  const auto n_features = header_.n_features;
+  if (!read_at(chunk->labels.data(), n * sizeof(double),
+               header_.labels_offset + first * sizeof(double))) {
+    return false;
+  }
+
+  if (header_.layout == Layout::ROW_MAJOR) {
+    return read_at(chunk->features.data(), n * n_features * sizeof(T),
+                   header_.features_offset + first * n_features * sizeof(T));
+  }
+
+  // Each feature is a separate run in a column major file.
+  column_.resize(n);
+  for (auto feature = 0ul; feature < n_features; ++feature) {
+    const auto offset = header_.features_offset +
+                        (feature * header_.n_samples + first) * sizeof(T);
+    if (!read_at(column_.data(), n * sizeof(T), offset)) return false;
+    for (auto sample = 0ul; sample < n; ++sample) {
+      chunk->features(sample, feature) = column_[sample];
+    }
+  }
+  return true;
+}
+
+template <typename T>
+bool BinaryDataSource<T>::read_at(void* out, std::size_t bytes,
+                                  std::uint64_t offset) const {
+  auto* cursor = static_cast<char*>(out);
+  while (bytes > 0) {
+    const auto n_read = pread(fd_, cursor, bytes, offset);
+    if (n_read <= 0) return false;
+    cursor += n_read;
+    bytes -= n_read;
+    offset += n_read;
+  }
+  return true;
+}
+
+// Loads the dataset in the csv file at csv_path, using a binary copy of it at
+// cache_path when possible.  If the cache is missing or older than the csv, the
+// csv is parsed on the thread pool and the cache is rewritten for next time.
+// Malformed lines are only reported when the csv is parsed.  Returns false if
+// neither file could be read.
+template <typename T>
+bool read_cached_csv_data_set(const std::string& csv_path,
+                              const std::string& cache_path,
+                              qp::threading::Threadpool* thread_pool,
+                              DataSet<T>* data_set,
+                              std::vector<MalformedRow>* malformed = nullptr) {
+  const auto csv_time = modification_time(csv_path);
+  if (modification_time(cache_path) >= csv_time &&
+      read_binary_data_set(cache_path, data_set)) {
+    return true;
+  }
+
+  qp::io::MappedFile csv(csv_path);
+  if (!csv) return false;
+
+  *data_set = read_csv_data_set_parallel<T>(csv, thread_pool, malformed);
+  // Failing to write the cache only costs a reparse next time.
+  write_binary_data_set(*data_set, cache_path);
+  return true;
+}
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* BINARY_DATASET_H */
@@ -0,0 +1,186 @@
+#ifndef BINNING_H
+#define BINNING_H
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dataset.h"
+#include "threadpool.h"
+
+/*
+ * Binned features.  Each feature of a dataset is quantized into at most 256
+ * bins whose boundaries are quantiles of its values, so that a splitter can
+ * count the labels falling in each bin in a single pass over a node and then
+ * score every boundary as a threshold from running sums.  The boundaries are
+ * plain feature values, so trees trained on bins still predict on the
+ * original features.  Once built the structure is read only, so every tree of
+ * a forest can share it.  It takes one byte per value of the dataset.
+ */
+
+namespace qp {
+namespace rf {
+
+// The bin of a value, as one byte.
+using Bin = std::uint8_t;
+
+constexpr std::size_t kMaxBins = std::numeric_limits<Bin>::max() + 1;
+
+template <typename T>
+class BinnedFeatures {
+ public:
+  // Bins every feature of the dataset into at most max_bins bins, one task
+  // per feature on the thread pool.
+  BinnedFeatures(const DataSet<T>& data_set,
+                 qp::threading::Threadpool* thread_pool,
+                 std::size_t max_bins = kMaxBins);
+
+  // The bin of every row of the dataset for a feature.
+  const Bin* bins(FeatureIndex feature) const {
+    return bins_.data() + feature * n_samples_;
+  }
+
+  std::size_t n_bins(FeatureIndex feature) const {
+    return cuts_[feature].size() + 1;
+  }
+
+  // The lower boundary of a bin, which is above every value in the bins
+  // before it.  A value is below the boundary exactly when its bin comes
+  // before the bin.  bin must be at least 1.
+  double lower_bound(FeatureIndex feature, std::size_t bin) const {
+    return cuts_[feature][bin - 1];
+  }
+
+  std::size_t n_samples() const { return n_samples_; }
+
+  std::size_t n_features() const { return n_features_; }
+
+ private:
+  void bin_feature(const DataSet<T>& data_set, FeatureIndex feature,
+                   std::size_t max_bins);
+
+  std::size_t n_samples_;
+  std::size_t n_features_;
+  // The bins of every feature, one feature after another.
+  std::vector<Bin> bins_;
+  // The boundaries between the bins of each feature, in increasing order.
+  std::vector<std::vector<double>> cuts_;
+};
+
+// The distinct values of a column in increasing order, each with the number
+// of times it occurs.
+template <typename T>
+std::vector<std::pair<T, std::size_t>> value_counts(FeatureView<T> column,
+                                                    std::size_t n_samples) {
+  std::vector<std::pair<T, std::size_t>> counts;
+  if (std::is_integral<T>::value && sizeof(T) == 1) {
+    // Byte features have few enough values to count directly.
+    std::array<std::size_t, 256> occurrences = {};
+    for (auto row = 0ul; row < n_samples; ++row) {
+      ++occurrences[static_cast<int>(column[row]) -
+                    std::numeric_limits<T>::min()];
+    }
+    for (auto i = 0; i < 256; ++i) {
+      if (occurrences[i] > 0) {
+        counts.emplace_back(i + std::numeric_limits<T>::min(), occurrences[i]);
+      }
+    }
+    return counts;
+  }
+
+  std::vector<T> values(n_samples);
+  for (auto row = 0ul; row < n_samples; ++row) {
+    values[row] = column[row];
+  }
+  std::sort(values.begin(), values.end());
+  for (const auto value : values) {
+    if (counts.empty() || counts.back().first != value) {
+      counts.emplace_back(value, 0);
+    }
+    ++counts.back().second;
+  }
+  return counts;
+}
+
+template <typename T>
+BinnedFeatures<T>::BinnedFeatures(const DataSet<T>& data_set,
+                                  qp::threading::Threadpool* thread_pool,
+                                  std::size_t max_bins)
+    : n_samples_(data_set.size()),
+      n_features_(data_set.n_features()),
+      bins_(n_samples_ * n_features_),
+      cuts_(n_features_) {
+  assert(max_bins >= 2 && max_bins <= kMaxBins);
+
+  std::vector<std::future<void>> futures;
+  futures.reserve(n_features_);
+  for (auto feature = 0ul; feature < n_features_; ++feature) {
+    futures.emplace_back(
+        thread_pool->add([this, &data_set, feature, max_bins]() {
+          bin_feature(data_set, feature, max_bins);
+        }));
+  }
+
+  for (auto& fut : futures) {
+    fut.wait();
+  }
+}
+
+template <typename T>
+void BinnedFeatures<T>::bin_feature(const DataSet<T>& data_set,
+                                    FeatureIndex feature,
+                                    std::size_t max_bins) {
+  const auto column = data_set.features.column(feature);
+  const auto counts = value_counts(column, n_samples_);
+
+  // Close a bin once it holds its share of the rows not yet binned, placing
+  // the boundary halfway to the next value.  With few enough distinct values
+  // every value gets its own bin.
+  auto& cuts = cuts_[feature];
+  auto remaining = n_samples_;
+  auto in_bin = 0ul;
+  for (auto i = 0ul; i + 1 < counts.size() && cuts.size() + 1 < max_bins;
+       ++i) {
+    in_bin += counts[i].second;
+    if (counts.size() <= max_bins ||
+        in_bin * (max_bins - cuts.size()) >= remaining) {
+      cuts.push_back(static_cast<double>(counts[i].first) / 2 +
+                     static_cast<double>(counts[i + 1].first) / 2);
+      remaining -= in_bin;
+      in_bin = 0;
+    }
+  }
+
+  const auto bin_of = [&cuts](T value) -> Bin {
+    return std::upper_bound(cuts.begin(), cuts.end(),
+                            static_cast<double>(value)) -
+           cuts.begin();
+  };
+  auto* bins = bins_.data() + feature * n_samples_;
+  if (std::is_integral<T>::value && sizeof(T) == 1) {
+    // Look the bins of byte features up rather than searching for each row.
+    std::array<Bin, 256> table;
+    for (auto i = 0; i < 256; ++i) {
+      table[i] = bin_of(i + std::numeric_limits<T>::min());
+    }
+    for (auto row = 0ul; row < n_samples_; ++row) {
+      bins[row] = table[static_cast<int>(column[row]) -
+                        std::numeric_limits<T>::min()];
+    }
+  } else {
+    for (auto row = 0ul; row < n_samples_; ++row) {
+      bins[row] = bin_of(column[row]);
+    }
+  }
+}
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* BINNING_H */
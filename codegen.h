@@ -0,0 +1,304 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dataset.h"
+#include "forest.h"
+#include "frozen_tree.h"
+#include "node.h"
+
+/*
+ * Code generation, for scoring without the library.  A trained forest of
+ * univariate splits is written out as a standalone C++ source file, each tree
+ * a function of nested if/else statements with its features and thresholds
+ * as literals, and the forest a single extern "C" function voting over them:
+ *
+ *   double qp_rf_predict(const T* features);
+ *
+ * where T is the type of the features the forest was trained on, and the
+ * features of a sample are contiguous.  The file needs nothing but a C++17
+ * compiler, so it can be built into programs which never link this library.
+ * With no nodes to load, the compiler sees every branch, and is free to lay
+ * out and schedule them.
+ *
+ * CompiledForest takes the same source through the local compiler into a
+ * shared library and loads it, so the process which trained a forest can
+ * score with the compiled code.
+ */
+
+namespace qp {
+namespace rf {
+
+// The name of the function a generated source file defines.
+constexpr const char* kGeneratedPredictFn = "qp_rf_predict";
+
+// The C++ spelling of the feature type T, for generated code.
+template <typename T>
+struct CppTypeName;
+
+template <>
+struct CppTypeName<double> {
+  static constexpr const char* value = "double";
+};
+
+template <>
+struct CppTypeName<float> {
+  static constexpr const char* value = "float";
+};
+
+template <>
+struct CppTypeName<std::uint8_t> {
+  static constexpr const char* value = "std::uint8_t";
+};
+
+namespace detail {
+
+// Subtrees are nested in their parent's function up to this depth, and below
+// it moved into functions of their own, so that fully grown trees stay within
+// what compilers will parse.
+constexpr int kMaxNestedDepth = 48;
+
+// Writes the functions of a single tree, named prefix followed by a number.
+// The first function written is the root's.
+template <typename TreeNode>
+class TreeWriter {
+ public:
+  TreeWriter(std::string prefix, const char* type_name)
+      : prefix_(std::move(prefix)), type_name_(type_name) {}
+
+  // Writes the declaration of every function to declarations and their
+  // definitions to definitions.
+  void write(const TreeNode* root, std::ostream& declarations,
+             std::ostream& definitions) {
+    pending_.push_back(root);
+    for (auto i = 0ul; i < pending_.size(); ++i) {
+      const auto signature = "unsigned " + prefix_ + std::to_string(i) +
+                             "(const " + type_name_ + "* f)";
+      declarations << "static " << signature << ";\n";
+      definitions << "static " << signature << " {\n";
+      write_node(pending_[i], 1, definitions);
+      definitions << "}\n\n";
+    }
+  }
+
+ private:
+  void write_node(const TreeNode* node, int depth, std::ostream& out) {
+    const std::string indent(2 * depth, ' ');
+    if (node->leaf()) {
+      out << indent << "return " << node->predict_class() << ";\n";
+      return;
+    }
+    if (depth > kMaxNestedDepth) {
+      out << indent << "return " << prefix_ << pending_.size() << "(f);\n";
+      pending_.push_back(node);
+      return;
+    }
+
+    const auto& splitter = node->splitter();
+    assert(std::isfinite(splitter.threshold()));
+    out << indent << "if (f[" << splitter.feature_index() << "] < "
+        << std::hexfloat << splitter.threshold() << std::defaultfloat
+        << ") {\n";
+    write_node(node->get_child(SplitDirection::LEFT), depth + 1, out);
+    out << indent << "} else {\n";
+    write_node(node->get_child(SplitDirection::RIGHT), depth + 1, out);
+    out << indent << "}\n";
+  }
+
+  std::string prefix_;
+  const char* type_name_;
+  // The nodes whose subtrees are given functions of their own, in the order
+  // the functions are numbered.
+  std::vector<const TreeNode*> pending_;
+};
+
+// Runs a program with arguments, the program first, and waits for it.
+// Returns whether it ran and exited successfully.
+bool run_command(const std::vector<std::string>& command) {
+  if (command.empty()) return false;
+  std::vector<char*> argv;
+  for (const auto& argument : command) {
+    argv.push_back(const_cast<char*>(argument.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  const auto pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+}  // namespace detail
+
+// Writes a standalone C++ source file which predicts as the forest does.
+// Thresholds and labels are written as hexadecimal floating point literals,
+// so that the generated code compares and returns exactly the same values.
+template <typename SplitterFn, typename T, typename ClassesT,
+          typename CriterionT>
+void write_forest_source(
+    const DecisionForest<SplitterFn, T, ClassesT, CriterionT>& forest,
+    std::ostream& out) {
+  static_assert(IsUnivariateSplit<SplitterFn>::value,
+                "only univariate splits can be generated");
+  using TreeNode =
+      typename DecisionForest<SplitterFn, T, ClassesT, CriterionT>::Tree::Node;
+  const auto* type_name = CppTypeName<T>::value;
+  const auto& labels = forest.labels();
+  const auto& trees = forest.trees();
+  assert(!labels.empty());
+
+  std::ostringstream declarations, definitions;
+  for (auto i = 0ul; i < trees.size(); ++i) {
+    detail::TreeWriter<TreeNode> writer("tree_" + std::to_string(i) + "_",
+                                        type_name);
+    writer.write(trees[i].root(), declarations, definitions);
+  }
+
+  out << "// Generated from a trained forest of " << trees.size()
+      << " trees.\n"
+      << "#include <cstdint>\n\n"
+      << declarations.str() << "\n"
+      << definitions.str();
+
+  // Votes are tallied as DecisionForest does, breaking ties towards the first
+  // label.
+  out << "extern \"C\" double " << kGeneratedPredictFn << "(const "
+      << type_name << "* f) {\n"
+      << "  static const double labels[" << labels.size() << "] = {";
+  for (auto i = 0ul; i < labels.size(); ++i) {
+    out << (i == 0 ? "" : ", ") << std::hexfloat << labels[i]
+        << std::defaultfloat;
+  }
+  out << "};\n"
+      << "  unsigned votes[" << labels.size() << "] = {};\n";
+  for (auto i = 0ul; i < trees.size(); ++i) {
+    out << "  ++votes[tree_" << i << "_0(f)];\n";
+  }
+  out << "  unsigned best = 0;\n"
+      << "  for (unsigned i = 1; i < " << labels.size() << "; ++i) {\n"
+      << "    if (votes[i] > votes[best]) best = i;\n"
+      << "  }\n"
+      << "  return labels[best];\n"
+      << "}\n";
+}
+
+// A forest compiled to native code by the local compiler and loaded into this
+// process.  T is the type of the features it predicts from.
+template <typename T = double>
+class CompiledForest {
+ public:
+  CompiledForest() = default;
+  CompiledForest(const CompiledForest&) = delete;
+  CompiledForest& operator=(const CompiledForest&) = delete;
+
+  CompiledForest(CompiledForest&& other) noexcept
+      : library_(std::exchange(other.library_, nullptr)),
+        predict_(std::exchange(other.predict_, nullptr)) {}
+
+  CompiledForest& operator=(CompiledForest&& other) noexcept {
+    unload();
+    library_ = std::exchange(other.library_, nullptr);
+    predict_ = std::exchange(other.predict_, nullptr);
+    return *this;
+  }
+
+  ~CompiledForest() { unload(); }
+
+  // Writes the forest's source to path followed by ".cpp", compiles it into
+  // a shared library at path followed by ".so", and loads it.  compiler is
+  // the program to compile with followed by any options, which are run
+  // directly rather than through a shell, so paths need no quoting.  Returns
+  // false if the source can not be written, or the library built or loaded.
+  //
+  // The loader keeps a single copy of a library for each path, so forests
+  // loaded at the same time must each be compiled to a path of their own.
+  // Fully grown trees make for large sources: ten trees of MNIST come to
+  // 38MB, which take minutes to compile at -O2.
+  template <typename SplitterFn, typename ClassesT, typename CriterionT>
+  bool compile(
+      const DecisionForest<SplitterFn, T, ClassesT, CriterionT>& forest,
+      const std::string& path,
+      std::vector<std::string> compiler = {"c++", "-O2"}) {
+    const auto source = path + ".cpp";
+    const auto library = path + ".so";
+    {
+      std::ofstream out(source);
+      write_forest_source(forest, out);
+      if (!out) return false;
+    }
+
+    compiler.insert(compiler.end(),
+                    {"-shared", "-fPIC", "-o", library, source});
+    if (!detail::run_command(compiler)) return false;
+    return load(library);
+  }
+
+  // Loads a library compiled from a source file written by
+  // write_forest_source for features of type T.  Returns false if it can not
+  // be loaded.
+  bool load(const std::string& library) {
+    unload();
+    library_ = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library_ == nullptr) return false;
+    predict_ =
+        reinterpret_cast<PredictFn>(dlsym(library_, kGeneratedPredictFn));
+    if (predict_ == nullptr) unload();
+    return loaded();
+  }
+
+  // Whether a compiled forest has been loaded.
+  bool loaded() const { return predict_ != nullptr; }
+
+  // Predict the label of a sample, as the forest it was compiled from would.
+  // The compiled code reads contiguous features, so those of a column major
+  // matrix are copied first.
+  double predict(FeatureView<T> features) const {
+    assert(loaded());
+    if (features.stride() == 1) return predict_(features.data());
+    thread_local std::vector<T> contiguous;
+    contiguous.resize(features.size());
+    for (auto i = 0ul; i < features.size(); ++i) {
+      contiguous[i] = features[i];
+    }
+    return predict_(contiguous.data());
+  }
+
+ private:
+  using PredictFn = double (*)(const T*);
+
+  void unload() {
+    if (library_ != nullptr) dlclose(library_);
+    library_ = nullptr;
+    predict_ = nullptr;
+  }
+
+  void* library_ = nullptr;
+  PredictFn predict_ = nullptr;
+};
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* CODEGEN_H */
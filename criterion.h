@@ -1,33 +1,322 @@
 #ifndef CRITERION_H
 #define CRITERION_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "dataset.h"
 
+/*
+ * Impurity criteria.  Gini, Entropy and Misclassification are policies for
+ * the CriterionT parameter of DecisionNode, DecisionTree and DecisionForest.
+ * Each scores a distribution through a running sum over its class counts, so
+ * that the same code scores one candidate at a time in scalar code, or one
+ * candidate per lane of a vector.  Built with AVX-512 or AVX2 enabled, such as
+ * with -march=native, split_impurities scores eight or four candidates at once.
+ */
+
 namespace qp {
 namespace rf {
 
+// Loads consecutive values into V, which is a double, or Lanes holding one
+// value per lane.
+template <typename V>
+V load_lanes(const double* values);
+
+#if defined(__AVX512F__)
+#define QP_RF_CRITERION_LANES
+using Lanes = __m512d;
+constexpr std::size_t kLanes = 8;
+
+template <>
+Lanes load_lanes<Lanes>(const double* values) {
+  return _mm512_loadu_pd(values);
+}
+
+void store_lanes(double* values, Lanes lanes) {
+  _mm512_storeu_pd(values, lanes);
+}
+
+Lanes broadcast_lanes(double value) { return _mm512_set1_pd(value); }
+
+Lanes lane_max(Lanes a, Lanes b) { return _mm512_max_pd(a, b); }
+
+// value where x is positive, and zero elsewhere.
+Lanes where_positive(Lanes x, Lanes value) {
+  return _mm512_maskz_mov_pd(
+      _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_GT_OQ), value);
+}
+
+// value, or infinity where a or b is zero.
+Lanes infinity_where_zero(Lanes a, Lanes b, Lanes value) {
+  const auto zero = _mm512_setzero_pd();
+  const auto mask = _mm512_cmp_pd_mask(a, zero, _CMP_EQ_OQ) |
+                    _mm512_cmp_pd_mask(b, zero, _CMP_EQ_OQ);
+  return _mm512_mask_blend_pd(
+      mask, value, _mm512_set1_pd(std::numeric_limits<double>::infinity()));
+}
+
+// Splits x into its exponent and a mantissa in [1, 2).
+void split_exponent(Lanes x, Lanes* exponent, Lanes* mantissa) {
+  const auto bits = _mm512_castpd_si512(x);
+  // The biased exponent placed in the low bits of 2^52 gives 2^52 plus it.
+  *exponent =
+      _mm512_castsi512_pd(_mm512_or_si512(
+          _mm512_srli_epi64(bits, 52), _mm512_set1_epi64(0x4330000000000000))) -
+      _mm512_set1_pd(4503599627370496.0 + 1023);
+  *mantissa = _mm512_castsi512_pd(_mm512_or_si512(
+      _mm512_and_si512(bits, _mm512_set1_epi64(0x000FFFFFFFFFFFFF)),
+      _mm512_set1_epi64(0x3FF0000000000000)));
+}
+
+// Halves the mantissa, and adds one to the exponent, where it is above
+// sqrt(2).
+void center_mantissa(Lanes* exponent, Lanes* mantissa) {
+  const auto mask = _mm512_cmp_pd_mask(*mantissa, _mm512_set1_pd(M_SQRT2),
+                                       _CMP_GT_OQ);
+  *mantissa = _mm512_mask_mul_pd(*mantissa, mask, *mantissa,
+                                 _mm512_set1_pd(0.5));
+  *exponent = _mm512_mask_add_pd(*exponent, mask, *exponent,
+                                 _mm512_set1_pd(1));
+}
+#elif defined(__AVX2__)
+#define QP_RF_CRITERION_LANES
+using Lanes = __m256d;
+constexpr std::size_t kLanes = 4;
+
+template <>
+Lanes load_lanes<Lanes>(const double* values) {
+  return _mm256_loadu_pd(values);
+}
+
+void store_lanes(double* values, Lanes lanes) {
+  _mm256_storeu_pd(values, lanes);
+}
+
+Lanes broadcast_lanes(double value) { return _mm256_set1_pd(value); }
+
+Lanes lane_max(Lanes a, Lanes b) { return _mm256_max_pd(a, b); }
+
+// value where x is positive, and zero elsewhere.
+Lanes where_positive(Lanes x, Lanes value) {
+  return _mm256_and_pd(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ),
+                       value);
+}
+
+// value, or infinity where a or b is zero.
+Lanes infinity_where_zero(Lanes a, Lanes b, Lanes value) {
+  const auto zero = _mm256_setzero_pd();
+  const auto mask = _mm256_or_pd(_mm256_cmp_pd(a, zero, _CMP_EQ_OQ),
+                                 _mm256_cmp_pd(b, zero, _CMP_EQ_OQ));
+  return _mm256_blendv_pd(
+      value, _mm256_set1_pd(std::numeric_limits<double>::infinity()), mask);
+}
+
+// Splits x into its exponent and a mantissa in [1, 2).
+void split_exponent(Lanes x, Lanes* exponent, Lanes* mantissa) {
+  const auto bits = _mm256_castpd_si256(x);
+  // The biased exponent placed in the low bits of 2^52 gives 2^52 plus it.
+  *exponent = _mm256_castsi256_pd(
+                  _mm256_or_si256(_mm256_srli_epi64(bits, 52),
+                                  _mm256_set1_epi64x(0x4330000000000000))) -
+              _mm256_set1_pd(4503599627370496.0 + 1023);
+  *mantissa = _mm256_castsi256_pd(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFF)),
+      _mm256_set1_epi64x(0x3FF0000000000000)));
+}
+
+// Halves the mantissa, and adds one to the exponent, where it is above
+// sqrt(2).
+void center_mantissa(Lanes* exponent, Lanes* mantissa) {
+  const auto mask =
+      _mm256_cmp_pd(*mantissa, _mm256_set1_pd(M_SQRT2), _CMP_GT_OQ);
+  *mantissa = _mm256_blendv_pd(*mantissa, *mantissa * 0.5, mask);
+  *exponent = *exponent + _mm256_and_pd(mask, _mm256_set1_pd(1));
+}
+#endif
+
+#ifdef QP_RF_CRITERION_LANES
+// The natural logarithm of each lane, which must be a positive normal number.
+// log(x) = e log(2) + log(m) for x = 2^e m, with m in [sqrt(1/2), sqrt(2)],
+// and log(m) = 2 atanh(s) for s = (m - 1) / (m + 1), whose series converges
+// to double precision within nine terms since |s| < 0.18.
+Lanes lane_log(Lanes x) {
+  Lanes exponent, mantissa;
+  split_exponent(x, &exponent, &mantissa);
+  center_mantissa(&exponent, &mantissa);
+
+  const auto one = broadcast_lanes(1);
+  const auto s = (mantissa - one) / (mantissa + one);
+  const auto s2 = s * s;
+  auto series = broadcast_lanes(1.0 / 17);
+  for (const double term : {1.0 / 15, 1.0 / 13, 1.0 / 11, 1.0 / 9, 1.0 / 7,
+                            1.0 / 5, 1.0 / 3, 1.0}) {
+    series = series * s2 + broadcast_lanes(term);
+  }
+  return exponent * broadcast_lanes(M_LN2) + broadcast_lanes(2) * s * series;
+}
+#endif
+
+// The scalar versions of the vector operations, for the candidates left over
+// after filling vectors, or when no vector instructions are enabled.
+template <>
+double load_lanes<double>(const double* values) {
+  return *values;
+}
+
+double lane_max(double a, double b) { return std::max(a, b); }
+
+double where_positive(double x, double value) { return x > 0 ? value : 0; }
+
+double infinity_where_zero(double a, double b, double value) {
+  return a == 0 || b == 0 ? std::numeric_limits<double>::infinity() : value;
+}
+
+double lane_log(double x) { return std::log(x); }
+
+// A criterion scores a distribution of n elements by accumulating each class
+// count into a running sum starting from zero, then taking weighted(n, sum),
+// which is n times the impurity of the distribution.  V is a double, or
+// Lanes holding one distribution per lane.
+
+// The probability that two elements drawn from the distribution have different
+// labels.
+// https://en.wikipedia.org/wiki/Decision_tree_learning#Gini_impurity
+struct Gini {
+  template <typename V>
+  static V accumulate(V sum, V count) {
+    return sum + count * count;
+  }
+
+  template <typename V>
+  static V weighted(V n, V sum) {
+    return n - sum / n;
+  }
+};
+
+// The information entropy of the labels, in nats.
+// https://en.wikipedia.org/wiki/Decision_tree_learning#Information_gain
+struct Entropy {
+  template <typename V>
+  static V accumulate(V sum, V count) {
+    return sum + where_positive(count, count * lane_log(count));
+  }
+
+  template <typename V>
+  static V weighted(V n, V sum) {
+    return n * lane_log(n) - sum;
+  }
+};
+
+// The fraction of elements which do not have the most common label.
+struct Misclassification {
+  template <typename V>
+  static V accumulate(V sum, V count) {
+    return lane_max(sum, count);
+  }
+
+  template <typename V>
+  static V weighted(V n, V sum) {
+    return n - sum;
+  }
+};
+
 // Given a histogram of label occurances, compute the gini impurity of the
 // distribution.  A return value of 0 means the distribution is totally pure
 // (a single label), and a return value of 1 means the distribution is impure
 // (all labels have an even number of occurances).
 // Returns a pair of (total_elements, impurity).
+// Histogram is either kind of label histogram, and with a FixedLabelHistogram
+// the loop is over a known number of classes.
 // https://en.wikipedia.org/wiki/Decision_tree_learning#Gini_impurity
+template <typename Histogram>
 std::pair<std::size_t, double> gini_impurity(
-    const LabelHistogram& label_histogram) {
-  std::size_t total_elements = 0;
-  for (const auto& label_count : label_histogram) {
-    total_elements += label_count.second;
-  }
+    const Histogram& label_histogram) {
+  const std::size_t total_elements = label_histogram.total();
+  if (total_elements == 0) return {0, 0};
 
   double total_elements_real = static_cast<double>(total_elements);
   double impurity = 0;
-  for (const auto& label_count : label_histogram) {
-    double p = label_count.second / total_elements_real;
+  for (const auto count : label_histogram) {
+    double p = count / total_elements_real;
     impurity += p * (1 - p);
   }
   return {total_elements, impurity};
 }
 
+// The impurity of a histogram under a criterion, which is 0 when it is empty.
+template <typename CriterionT, typename Histogram>
+double impurity(const Histogram& label_histogram) {
+  const double n = label_histogram.total();
+  if (n == 0) return 0;
+
+  double sum = 0;
+  for (const double count : label_histogram) {
+    sum = CriterionT::accumulate(sum, count);
+  }
+  return CriterionT::weighted(n, sum) / n;
+}
+
+// The impurity of splitting a distribution into left and right, as the
+// average of their impurities weighted by the number of elements in each.
+template <typename CriterionT = Gini, typename Histogram>
+double split_impurity(const Histogram& left, const Histogram& right) {
+  const double n_left = left.total();
+  const double n_right = right.total();
+  return (n_left * impurity<CriterionT>(left) +
+          n_right * impurity<CriterionT>(right)) /
+         (n_left + n_right);
+}
+
+// The split impurity of the candidates in the lanes of V, reading class c of
+// the first from left[c * stride] and right[c * stride].
+template <typename CriterionT, typename V>
+V split_impurity_lanes(const double* left, const double* right,
+                       std::size_t n_classes, std::size_t stride) {
+  V n_left{}, n_right{}, left_sum{}, right_sum{};
+  for (auto c = 0ul; c < n_classes; ++c) {
+    const auto left_count = load_lanes<V>(left + c * stride);
+    const auto right_count = load_lanes<V>(right + c * stride);
+    n_left = n_left + left_count;
+    n_right = n_right + right_count;
+    left_sum = CriterionT::accumulate(left_sum, left_count);
+    right_sum = CriterionT::accumulate(right_sum, right_count);
+  }
+  return infinity_where_zero(n_left, n_right,
+                             (CriterionT::weighted(n_left, left_sum) +
+                              CriterionT::weighted(n_right, right_sum)) /
+                                 (n_left + n_right));
+}
+
+// Scores n_candidates splits at once.  left and right hold the class counts of
+// either side class by class, the count of class c for candidate i being at
+// c * n_candidates + i, so that a vector holds one class of several
+// candidates.  Writes the impurity of each split to impurities, or infinity
+// if one of its sides is empty.
+template <typename CriterionT>
+void split_impurities(const double* left, const double* right,
+                      std::size_t n_classes, std::size_t n_candidates,
+                      double* impurities) {
+  auto i = 0ul;
+#ifdef QP_RF_CRITERION_LANES
+  for (; i + kLanes <= n_candidates; i += kLanes) {
+    store_lanes(impurities + i,
+                split_impurity_lanes<CriterionT, Lanes>(
+                    left + i, right + i, n_classes, n_candidates));
+  }
+#endif
+  for (; i < n_candidates; ++i) {
+    impurities[i] = split_impurity_lanes<CriterionT, double>(
+        left + i, right + i, n_classes, n_candidates);
+  }
+}
+
 }  // namespace rf
 }  // namespace qp
 
@@ -1,29 +1,396 @@
 #ifndef MNIST_H
 #define MNIST_H
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <future>
 #include <iostream>
+#include <numeric>
+#include <vector>
+
 #include "dataset.h"
+#include "mapped_file.h"
+#include "sparse.h"
+#include "threadpool.h"
 
 namespace qp {
 namespace rf {
 
 // Read csv dataset from the given input stream.  Data should follow the format:
 // label,f1,f2,f3...
-DataSet read_csv_data_set(std::istream& is, std::size_t n_samples,
-                          std::size_t n_features) {
-  auto set = qp::rf::empty_data_set(n_samples, n_features);
+// Features are converted to T as they are read.
+template <typename T = double>
+DataSet<T> read_csv_data_set(std::istream& is, std::size_t n_samples,
+                             std::size_t n_features,
+                             Layout layout = Layout::COLUMN_MAJOR) {
+  auto set = qp::rf::empty_data_set<T>(n_samples, n_features, layout);
   for (unsigned sample = 0; sample < n_samples; ++sample) {
-    is >> set[sample].label;
+    is >> set.labels[sample];
     for (unsigned feature = 0; feature < n_features; ++feature) {
-      // Ignore the comma.
+      // Ignore the comma.  Values are read as doubles, since streaming
+      // directly into a narrow type such as uint8_t would read characters.
       is.ignore(1);
-      is >> set[sample].features[feature];
+      double value;
+      is >> value;
+      set.features(sample, feature) = static_cast<T>(value);
     }
   }
 
   return set;
 }
 
+// A line of a csv file which could not be read into a dataset.
+struct MalformedRow {
+  // 1 based line number within the file.
+  std::size_t line;
+  const char* reason;
+};
+
+// The dimensions of a csv dataset.
+struct CsvShape {
+  // Number of lines, including any which turn out to be blank or malformed.
+  std::size_t n_rows;
+  std::size_t n_features;
+};
+
+namespace {
+
+bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+const char* skip_blanks(const char* first, const char* last) {
+  while (first != last && is_blank(*first)) ++first;
+  return first;
+}
+
+bool is_digit(char c) { return static_cast<unsigned char>(c - '0') < 10; }
+
+// Parses a single number along with any blanks around it.  Returns a pointer
+// past the field, or nullptr if it does not hold a number.
+const char* parse_field(const char* first, const char* last, double& value) {
+  first = skip_blanks(first, last);
+
+  // Most datasets, MNIST included, are made up of small unsigned integers.
+  // Accumulating those by hand is several times faster than from_chars, so
+  // only fall back to it for anything else.
+  constexpr int kMaxFastDigits = 15;
+  std::uint64_t integer = 0;
+  const auto* digit = first;
+  while (digit != last && digit - first < kMaxFastDigits && is_digit(*digit)) {
+    integer = integer * 10 + (*digit - '0');
+    ++digit;
+  }
+  // The integer is only complete if it does not carry on as a fraction, an
+  // exponent, or more digits than were accumulated.
+  const bool complete = digit == last || (*digit != '.' && *digit != 'e' &&
+                                          *digit != 'E' && !is_digit(*digit));
+  if (digit != first && complete) {
+    value = static_cast<double>(integer);
+    return skip_blanks(digit, last);
+  }
+
+  const auto result = std::from_chars(first, last, value);
+  if (result.ec != std::errc()) return nullptr;
+  return skip_blanks(result.ptr, last);
+}
+
+// Finds the end of the line starting at first.
+const char* line_end(const char* first, const char* last) {
+  const auto* newline =
+      static_cast<const char*>(std::memchr(first, '\n', last - first));
+  return newline == nullptr ? last : newline;
+}
+
+bool blank_line(const char* first, const char* last) {
+  return skip_blanks(first, last) == last;
+}
+
+// Parses a line of the form label,f1,f2... into the given row of the dataset.
+// Returns nullptr on success, or a description of the problem otherwise.
+template <typename T>
+const char* parse_csv_line(const char* first, const char* last,
+                           std::size_t sample, DataSet<T>& set) {
+  double value;
+  first = parse_field(first, last, value);
+  if (first == nullptr) return "invalid label";
+  set.labels[sample] = value;
+
+  const auto n_features = set.n_features();
+  for (auto feature = 0ul; feature < n_features; ++feature) {
+    if (first == last || *first != ',') return "too few fields";
+    first = parse_field(first + 1, last, value);
+    if (first == nullptr) return "invalid feature";
+    set.features(sample, feature) = static_cast<T>(value);
+  }
+
+  if (first != last) return "too many fields";
+  return nullptr;
+}
+
+// Parses the lines between first and last into consecutive rows of the
+// dataset, starting at first_row.  first_line is the line number of first
+// within the file, used when reporting malformed lines.  Returns the number
+// of rows written.
+template <typename T>
+std::size_t parse_csv_lines(const char* first, const char* last,
+                            std::size_t first_row, std::size_t first_line,
+                            DataSet<T>& set,
+                            std::vector<MalformedRow>* malformed) {
+  auto sample = first_row;
+  auto line = first_line;
+  while (first < last) {
+    const auto* end = line_end(first, last);
+    if (!blank_line(first, end)) {
+      const auto* error = parse_csv_line(first, end, sample, set);
+      if (error == nullptr) {
+        ++sample;
+      } else if (malformed != nullptr) {
+        malformed->push_back({line, error});
+      }
+    }
+    first = end + 1;
+    ++line;
+  }
+  return sample - first_row;
+}
+
+// The rows of a sparse dataset as they are read, in the form taken by
+// SparseFeatureMatrix.
+template <typename T>
+struct SparseRows {
+  std::vector<std::size_t> offsets = {0};
+  std::vector<SparseFeatureIndex> features;
+  std::vector<T> values;
+  std::vector<double> labels;
+};
+
+// Like parse_csv_line, but appends the line to the rows, keeping only the
+// features which are not zero.  Nothing is appended if the line is malformed.
+template <typename T>
+const char* parse_sparse_csv_line(const char* first, const char* last,
+                                  std::size_t n_features, SparseRows<T>& rows) {
+  const auto n_stored = rows.values.size();
+  const auto malformed = [&rows, n_stored](const char* reason) {
+    rows.features.resize(n_stored);
+    rows.values.resize(n_stored);
+    return reason;
+  };
+
+  double label;
+  first = parse_field(first, last, label);
+  if (first == nullptr) return "invalid label";
+
+  for (auto feature = 0ul; feature < n_features; ++feature) {
+    if (first == last || *first != ',') return malformed("too few fields");
+    double value;
+    first = parse_field(first + 1, last, value);
+    if (first == nullptr) return malformed("invalid feature");
+    if (static_cast<T>(value) != 0) {
+      rows.features.push_back(feature);
+      rows.values.push_back(static_cast<T>(value));
+    }
+  }
+
+  if (first != last) return malformed("too many fields");
+  rows.labels.push_back(label);
+  rows.offsets.push_back(rows.values.size());
+  return nullptr;
+}
+
+// Counts the lines between first and last, including a final line without a
+// trailing newline.
+std::size_t count_lines(const char* first, const char* last) {
+  if (first == last) return 0;
+  return std::count(first, last, '\n') + (*(last - 1) != '\n' ? 1 : 0);
+}
+
+// Splits the characters between first and last into chunks of roughly
+// chunk_bytes, each ending just after a newline.  Returns the boundaries of
+// the chunks, starting with first and ending with last.
+std::vector<const char*> split_lines(const char* first, const char* last,
+                                     std::size_t chunk_bytes) {
+  std::vector<const char*> boundaries = {first};
+  auto* current = first;
+  while (static_cast<std::size_t>(last - current) > chunk_bytes) {
+    current = line_end(current + chunk_bytes, last);
+    if (current == last) break;
+    boundaries.push_back(++current);
+  }
+  if (boundaries.back() != last) boundaries.push_back(last);
+  return boundaries;
+}
+
+}  // namespace
+
+// Determines the number of rows and features in the csv data between first
+// and last.  The number of features is taken from the first line which is not
+// blank.  Every line is counted as a row, blank or not.
+CsvShape csv_shape(const char* first, const char* last) {
+  CsvShape shape = {0, 0};
+  if (first == last) return shape;
+
+  shape.n_rows = count_lines(first, last);
+  while (first < last) {
+    const auto* end = line_end(first, last);
+    if (!blank_line(first, end)) {
+      shape.n_features = std::count(first, end, ',');
+      break;
+    }
+    first = end + 1;
+  }
+  return shape;
+}
+
+// Read a csv dataset from the characters between first and last, usually a
+// memory mapped file.  Rows and columns are detected automatically, with the
+// column count taken from the first line which is not blank.  Blank lines are
+// ignored.  Lines which cannot be parsed are skipped, and are appended to
+// malformed if it is given.
+template <typename T = double>
+DataSet<T> read_csv_data_set(const char* first, const char* last,
+                             std::vector<MalformedRow>* malformed = nullptr,
+                             Layout layout = Layout::COLUMN_MAJOR) {
+  const auto shape = csv_shape(first, last);
+  auto set = qp::rf::empty_data_set<T>(shape.n_rows, shape.n_features, layout);
+
+  const auto n_rows = parse_csv_lines(first, last, 0, 1, set, malformed);
+
+  // Drop the rows reserved for blank or malformed lines.
+  set.features.truncate_samples(n_rows);
+  set.labels.resize(n_rows);
+  return set;
+}
+
+// Lines are parsed in chunks of roughly this many bytes when reading in
+// parallel.
+constexpr std::size_t kCsvChunkBytes = 4 << 20;
+
+// Same as read_csv_data_set, but the data is split into chunks at line
+// boundaries and the chunks are parsed concurrently on the thread pool.  Each
+// chunk is parsed directly into the rows of the dataset reserved for it.
+template <typename T = double>
+DataSet<T> read_csv_data_set_parallel(
+    const char* first, const char* last,
+    qp::threading::Threadpool* thread_pool,
+    std::vector<MalformedRow>* malformed = nullptr,
+    Layout layout = Layout::COLUMN_MAJOR,
+    std::size_t chunk_bytes = kCsvChunkBytes) {
+  const auto boundaries = split_lines(first, last, chunk_bytes);
+  const auto n_chunks = boundaries.size() - 1;
+
+  // Every line reserves a row, so the first row of each chunk is the number
+  // of lines before it.
+  std::vector<std::size_t> first_rows(n_chunks + 1, 0);
+  {
+    std::vector<std::future<void>> futures;
+    futures.reserve(n_chunks);
+    for (auto chunk = 0ul; chunk < n_chunks; ++chunk) {
+      futures.emplace_back(thread_pool->add([&, chunk]() {
+        first_rows[chunk + 1] =
+            count_lines(boundaries[chunk], boundaries[chunk + 1]);
+      }));
+    }
+    for (auto& fut : futures) fut.wait();
+  }
+  std::partial_sum(first_rows.begin(), first_rows.end(), first_rows.begin());
+
+  const auto n_features = csv_shape(first, last).n_features;
+  auto set =
+      qp::rf::empty_data_set<T>(first_rows[n_chunks], n_features, layout);
+
+  std::vector<std::size_t> rows_written(n_chunks);
+  std::vector<std::vector<MalformedRow>> chunk_errors(n_chunks);
+  {
+    std::vector<std::future<void>> futures;
+    futures.reserve(n_chunks);
+    for (auto chunk = 0ul; chunk < n_chunks; ++chunk) {
+      futures.emplace_back(thread_pool->add([&, chunk]() {
+        rows_written[chunk] = parse_csv_lines(
+            boundaries[chunk], boundaries[chunk + 1], first_rows[chunk],
+            first_rows[chunk] + 1, set, &chunk_errors[chunk]);
+      }));
+    }
+    for (auto& fut : futures) fut.wait();
+  }
+
+  // Close any gaps left by blank or malformed lines.  Normally there are none
+  // and nothing is moved.
+  std::size_t n_rows = 0;
+  for (auto chunk = 0ul; chunk < n_chunks; ++chunk) {
+    if (first_rows[chunk] != n_rows) {
+      set.features.move_samples(first_rows[chunk], n_rows,
+                                rows_written[chunk]);
+      std::copy_n(set.labels.begin() + first_rows[chunk], rows_written[chunk],
+                  set.labels.begin() + n_rows);
+    }
+    n_rows += rows_written[chunk];
+
+    if (malformed != nullptr) {
+      malformed->insert(malformed->end(), chunk_errors[chunk].begin(),
+                        chunk_errors[chunk].end());
+    }
+  }
+
+  set.features.truncate_samples(n_rows);
+  set.labels.resize(n_rows);
+  return set;
+}
+
+// Read a csv dataset from a memory mapped file.
+template <typename T = double>
+DataSet<T> read_csv_data_set(const qp::io::MappedFile& file,
+                             std::vector<MalformedRow>* malformed = nullptr,
+                             Layout layout = Layout::COLUMN_MAJOR) {
+  return read_csv_data_set<T>(file.begin(), file.end(), malformed, layout);
+}
+
+// Read a csv dataset from a memory mapped file in parallel.
+template <typename T = double>
+DataSet<T> read_csv_data_set_parallel(
+    const qp::io::MappedFile& file, qp::threading::Threadpool* thread_pool,
+    std::vector<MalformedRow>* malformed = nullptr,
+    Layout layout = Layout::COLUMN_MAJOR) {
+  return read_csv_data_set_parallel<T>(file.begin(), file.end(), thread_pool,
+                                       malformed, layout);
+}
+
+// Like read_csv_data_set, but only the values which are not zero are stored,
+// so that the dataset takes memory in proportion to them rather than to the
+// number of features.
+template <typename T = double>
+SparseDataSet<T> read_sparse_csv_data_set(
+    const char* first, const char* last,
+    std::vector<MalformedRow>* malformed = nullptr) {
+  const auto n_features = csv_shape(first, last).n_features;
+  SparseRows<T> rows;
+  auto line = 1ul;
+  while (first < last) {
+    const auto* end = line_end(first, last);
+    if (!blank_line(first, end)) {
+      const auto* error = parse_sparse_csv_line(first, end, n_features, rows);
+      if (error != nullptr && malformed != nullptr) {
+        malformed->push_back({line, error});
+      }
+    }
+    first = end + 1;
+    ++line;
+  }
+
+  return {SparseFeatureMatrix<T>(n_features, std::move(rows.offsets),
+                                 std::move(rows.features),
+                                 std::move(rows.values)),
+          std::move(rows.labels)};
+}
+
+// Read a sparse csv dataset from a memory mapped file.
+template <typename T = double>
+SparseDataSet<T> read_sparse_csv_data_set(
+    const qp::io::MappedFile& file,
+    std::vector<MalformedRow>* malformed = nullptr) {
+  return read_sparse_csv_data_set<T>(file.begin(), file.end(), malformed);
+}
+
 }  // namespace rf
 }  // namespace qp
 
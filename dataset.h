@@ -2,136 +2,393 @@
 #define DATASET_H
 
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <numeric>
 #include <set>
-#include <unordered_map>
+#include <type_traits>
 #include <vector>
 
+#include "feature_matrix.h"
 #include "functional.h"
 #include "random.h"
+#include "threadpool.h"
 #include "vector_util.h"
 
 /* Defines types and operations related to Datasets.  A Dataset is defined as a
- * collection of Examples.  An example is simply a list of a features and
- * a label.
+ * matrix of features, with one row per example, and a label for each row.
  */
 
 namespace qp {
 namespace rf {
 
-// A training example defined by a set of features and a label.
-struct Example {
-  std::vector<double> features;
-  double label;
+// A dataset is a collection of training examples.  The features of every
+// example are stored together in a single matrix, and the labels are stored
+// in a separate array.  T is the type features are stored as.
+template <typename T = double>
+struct DataSet {
+  using value_type = T;
+
+  FeatureMatrix<T> features;
+  std::vector<double> labels;
+
+  std::size_t size() const { return labels.size(); }
+
+  std::size_t n_features() const { return features.n_features(); }
 };
 
-// An example that has been sampled from a dataset.  The reference wrapper
-// provides fast copying when sampling large datasets.
-using SampledExample = std::reference_wrapper<const Example>;
+// The row of a sample in a dataset.  Datasets are limited to 2^32 samples so
+// that index lists stay small.
+using SampleIndex = std::uint32_t;
+
+// A sample of a dataset, as the row indices of the sampled examples.  Trees
+// each reorder their own sample while sharing the dataset itself.
+using SampledDataSet = std::vector<SampleIndex>;
 
-using FeatureIndex = std::size_t;
+using SDIter = SampledDataSet::iterator;
+
+// How many times each row of a dataset was drawn into a bootstrap sample.
+// Counts saturate at 255, though a row is practically never drawn that often.
+using SampleCounts = std::vector<std::uint8_t>;
+
+// The class of a label, numbering the distinct labels of a dataset densely from
+// 0.
+using ClassIndex = std::uint32_t;
+
+// The labels of a dataset as dense class numbers, so that label histograms can
+// be flat arrays indexed by class rather than hash maps keyed by label.
+// Classes are numbered in increasing order of their labels, and the labels
+// are kept to translate classes back.
+struct EncodedLabels {
+  // The label of each class.
+  std::vector<double> values;
+  // The class of each row of the dataset.
+  std::vector<ClassIndex> classes;
+
+  std::size_t n_classes() const { return values.size(); }
+
+  // The class of a label, which must be one of the values.
+  ClassIndex encode(double label) const {
+    return std::lower_bound(values.begin(), values.end(), label) -
+           values.begin();
+  }
+};
 
-// A comparator which compares the i'th feature of two training examples using
-// Cmp.  Overloaded to work with sampled or unsampled datasets.
-template <typename Cmp = std::less<double>>
+// Numbers the distinct labels of a dataset, and translates every row's label.
+EncodedLabels encode_labels(const std::vector<double>& labels) {
+  EncodedLabels encoded;
+  encoded.values = labels;
+  std::sort(encoded.values.begin(), encoded.values.end());
+  encoded.values.erase(
+      std::unique(encoded.values.begin(), encoded.values.end()),
+      encoded.values.end());
+
+  encoded.classes.reserve(labels.size());
+  for (const auto label : labels) {
+    encoded.classes.push_back(encoded.encode(label));
+  }
+  return encoded;
+}
+
+template <typename T>
+class PresortedFeatures;
+
+template <typename T>
+class BinnedFeatures;
+
+// What a tree is trained on: the dataset, its encoded labels, the number of
+// times each row was drawn into the tree's sample, and optionally the
+// presorted or binned features of the dataset.  DataSetT is DataSet<T>, or
+// SparseDataSet<T> for sparse features, which are never presorted or binned.
+template <typename T = double, typename DataSetT = DataSet<T>>
+struct TrainingData {
+  const DataSetT& data_set;
+  const EncodedLabels& labels;
+  const SampleCounts& counts;
+  const PresortedFeatures<T>* presorted = nullptr;
+  const BinnedFeatures<T>* binned = nullptr;
+};
+
+// A comparator which compares the i'th feature of two samples of a dataset
+// using Cmp.
+template <typename T, typename Cmp = std::less<>>
 class CompareOnFeature {
  public:
-  CompareOnFeature(FeatureIndex i) : fx_(i) {}
+  CompareOnFeature(const DataSet<T>& data_set, FeatureIndex i)
+      : column_(data_set.features.column(i)) {}
 
-  bool operator()(const SampledExample& lhs, const SampledExample& rhs) const {
-    return cmp_(lhs.get().features[fx_], rhs.get().features[fx_]);
+  bool operator()(SampleIndex lhs, SampleIndex rhs) const {
+    return cmp_(column_[lhs], column_[rhs]);
   }
 
-  bool operator()(const Example& lhs, const Example& rhs) const {
-    return cmp_(lhs.features[fx_], rhs.features[fx_]);
+ private:
+  Cmp cmp_;
+  FeatureView<T> column_;
+};
+
+// The number of samples of each class among some samples, indexed by class.
+// Histograms of up to kInlineClasses classes are counted in place, so that
+// the common case needs no allocation, and larger ones on the heap.
+class LabelHistogram {
+ public:
+  static constexpr std::size_t kInlineClasses = 16;
+
+  explicit LabelHistogram(std::size_t n_classes = 0)
+      : n_classes_(n_classes),
+        heap_(n_classes > kInlineClasses ? n_classes : 0) {
+    inline_.fill(0);
   }
 
+  std::size_t& operator[](ClassIndex c) { return data()[c]; }
+
+  std::size_t operator[](ClassIndex c) const { return data()[c]; }
+
+  // The number of classes, whether or not any samples have them.
+  std::size_t size() const { return n_classes_; }
+
+  // The total number of samples counted.
+  std::size_t total() const { return std::accumulate(begin(), end(), 0ul); }
+
+  void clear() { std::fill(begin(), end(), 0); }
+
+  std::size_t* begin() { return data(); }
+
+  std::size_t* end() { return data() + n_classes_; }
+
+  const std::size_t* begin() const { return data(); }
+
+  const std::size_t* end() const { return data() + n_classes_; }
+
  private:
-  Cmp cmp_;
-  FeatureIndex fx_;
+  std::size_t* data() {
+    return n_classes_ > kInlineClasses ? heap_.data() : inline_.data();
+  }
+
+  const std::size_t* data() const {
+    return n_classes_ > kInlineClasses ? heap_.data() : inline_.data();
+  }
+
+  std::size_t n_classes_;
+  std::array<std::size_t, kInlineClasses> inline_;
+  std::vector<std::size_t> heap_;
 };
 
-// A dataset is a collection of training examples.
-using DataSet = std::vector<Example>;
+// A label histogram for exactly K classes, known at compile time, so that
+// loops over it can be unrolled and it never allocates.  It has the same
+// interface as LabelHistogram.  Counts are 32 bits, which holds the draws of
+// any sample of a dataset, since datasets have at most 2^32 rows.
+template <std::size_t K>
+class FixedLabelHistogram {
+ public:
+  // n_classes is only checked, so the histogram can be made the same way as
+  // a LabelHistogram.
+  explicit FixedLabelHistogram(std::size_t n_classes = K) {
+    assert(n_classes <= K);
+    (void)n_classes;
+    counts_.fill(0);
+  }
+
+  std::uint32_t& operator[](ClassIndex c) { return counts_[c]; }
 
-// A sampled dataset. Defined for fast copying.
-using SampledDataSet = std::vector<SampledExample>;
+  std::uint32_t operator[](ClassIndex c) const { return counts_[c]; }
 
-using SDIter = SampledDataSet::iterator;
+  constexpr std::size_t size() const { return K; }
+
+  std::size_t total() const {
+    return std::accumulate(begin(), end(), std::size_t(0));
+  }
+
+  void clear() { counts_.fill(0); }
+
+  std::uint32_t* begin() { return counts_.data(); }
+
+  std::uint32_t* end() { return counts_.data() + K; }
+
+  const std::uint32_t* begin() const { return counts_.data(); }
+
+  const std::uint32_t* end() const { return counts_.data() + K; }
+
+ private:
+  std::array<std::uint32_t, K> counts_;
+};
+
+// The number of classes trees are trained on, as a template parameter of
+// DecisionNode, DecisionTree and DecisionForest.  Classes<K> fixes it at K
+// at compile time, and the dataset must have at most K distinct labels.  The
+// default, Classes<>, finds it at run time.
+template <std::size_t K = 0>
+struct Classes {
+  using Histogram = FixedLabelHistogram<K>;
+};
 
-using LabelHistogram = std::unordered_map<double, std::size_t>;
+template <>
+struct Classes<0> {
+  using Histogram = LabelHistogram;
+};
 
 // Generates an empty dataset with n_samples, each containing n_features.
-DataSet empty_data_set(std::size_t n_samples, std::size_t n_features) {
-  DataSet data_set(n_samples);
-  for (auto& example : data_set) {
-    example.features.resize(n_features);
+template <typename T = double>
+DataSet<T> empty_data_set(std::size_t n_samples, std::size_t n_features,
+                          Layout layout = Layout::COLUMN_MAJOR) {
+  return {FeatureMatrix<T>(n_samples, n_features, layout),
+          std::vector<double>(n_samples, 0)};
+}
+
+// Draws n random rows with replacement from a dataset of n_rows rows.  Rather
+// than listing duplicates, each drawn row appears once, in increasing order,
+// and counts records how many times it was drawn.
+SampledDataSet sample_with_replacement(std::size_t n_rows, std::size_t n,
+                                       SampleCounts* counts) {
+  counts->assign(n_rows, 0);
+  for (std::size_t i = 0; i < n; ++i) {
+    auto& count = (*counts)[random_range<SampleIndex>(0, n_rows - 1)];
+    if (count < std::numeric_limits<std::uint8_t>::max()) ++count;
   }
-  return data_set;
+
+  SampledDataSet sample;
+  for (auto row = 0ul; row < n_rows; ++row) {
+    if ((*counts)[row] > 0) sample.push_back(row);
+  }
+  return sample;
 }
 
 // Sample n random items from the provided dataset with replacement.
-SampledDataSet sample_with_replacement(const DataSet& data_set, std::size_t n) {
+template <typename T>
+SampledDataSet sample_with_replacement(const DataSet<T>& data_set,
+                                       std::size_t n, SampleCounts* counts) {
+  return sample_with_replacement(data_set.size(), n, counts);
+}
+
+// Draws n distinct random rows from a dataset of n_rows rows, in increasing
+// order.  Each drawn row gets a count of one.  This is selection sampling
+// (Knuth's Algorithm S), which takes a single pass over the rows and needs no
+// memory beyond the sample.
+SampledDataSet sample_without_replacement(std::size_t n_rows, std::size_t n,
+                                          SampleCounts* counts) {
+  counts->assign(n_rows, 0);
   SampledDataSet sample;
-  const std::size_t total_examples = data_set.size();
-  for (std::size_t i = 0; i < n; ++i) {
-    sample.push_back(
-        data_set[random_range<std::size_t>(0ul, total_examples - 1)]);
+  sample.reserve(n);
+  for (auto row = 0ul; row < n_rows && sample.size() < n; ++row) {
+    const auto needed = n - sample.size();
+    const auto remaining = n_rows - row;
+    if (random_range<std::size_t>(0, remaining - 1) < needed) {
+      sample.push_back(row);
+      (*counts)[row] = 1;
+    }
   }
   return sample;
 }
 
-// Creates a sampled dataset that contains exactly the elements of the source.
-SampledDataSet sample_exactly(const DataSet& dataset) {
-  SampledDataSet sample;
-  sample.reserve(dataset.size());
-  for (const auto& example : dataset) {
-    sample.push_back(example);
+// Sample n random items from the provided dataset without replacement.
+template <typename T>
+SampledDataSet sample_without_replacement(const DataSet<T>& data_set,
+                                          std::size_t n,
+                                          SampleCounts* counts) {
+  return sample_without_replacement(data_set.size(), n, counts);
+}
+
+// Draws the sample a tree of a forest is trained on.  A sample_fraction of one
+// is a bootstrap sample the size of the dataset.  Anything less draws that
+// fraction of the rows without replacement, which trains proportionally
+// faster on large datasets.
+SampledDataSet sample_for_tree(std::size_t n_rows, double sample_fraction,
+                               SampleCounts* counts) {
+  if (sample_fraction >= 1) {
+    return sample_with_replacement(n_rows, n_rows, counts);
   }
+
+  const auto n =
+      std::max<std::size_t>(std::lround(sample_fraction * n_rows), 1);
+  return sample_without_replacement(n_rows, std::min(n, n_rows), counts);
+}
+
+// Creates a sampled dataset that contains exactly the elements of the source.
+template <typename T>
+SampledDataSet sample_exactly(const DataSet<T>& dataset) {
+  SampledDataSet sample(dataset.size());
+  std::iota(sample.begin(), sample.end(), 0);
   return sample;
 }
 
-// Finds the most commonly occurring label in the dataset.
-double mode_label(SDIter start, SDIter end) {
-  LabelHistogram histogram;
-  while (start != end) {
-    ++histogram[start->get().label];
-    ++start;
+// Finds the most common class in a histogram.
+template <typename Histogram>
+ClassIndex mode_class(const Histogram& histogram) {
+  return std::max_element(histogram.begin(), histogram.end()) -
+         histogram.begin();
+}
+
+// Finds the most common class among the samples between first and last.
+ClassIndex mode_class(const EncodedLabels& labels, SDIter first, SDIter last) {
+  LabelHistogram histogram(labels.n_classes());
+  for (auto sample = first; sample != last; ++sample) {
+    ++histogram[labels.classes[*sample]];
   }
+  return mode_class(histogram);
+}
 
-  const auto mode = std::max_element(histogram.begin(), histogram.end(),
-                                     CompareOnSecond<double, int>());
-  return mode->first;
+// Like mode_class, but counting each sample as many times as it was drawn.
+// The samples are counted in a Histogram, either kind of label histogram.
+template <typename Histogram = LabelHistogram>
+ClassIndex mode_class(const EncodedLabels& labels, const SampleCounts& counts,
+                      SDIter first, SDIter last) {
+  Histogram histogram(labels.n_classes());
+  for (auto sample = first; sample != last; ++sample) {
+    histogram[labels.classes[*sample]] += counts[*sample];
+  }
+  return mode_class(histogram);
 }
 
-// Determines if the dataset contains a single label.
-bool single_label(SDIter start, SDIter end) {
-  const auto first_label = start->get().label;
-  const auto equals_first_label = [&first_label](const auto& example) {
-    return first_label == example.get().label;
-  };
+// Determines if the samples between first and last all have the same label.
+template <typename DataSetT>
+bool single_label(const DataSetT& data_set, SDIter first, SDIter last) {
+  const auto first_label = data_set.labels[*first];
+  return std::all_of(first, last, [&](SampleIndex sample) {
+    return data_set.labels[sample] == first_label;
+  });
+}
 
-  return std::all_of(start, end, equals_first_label);
+// The smallest and largest values of a feature among the samples between
+// first and last.
+template <typename T>
+std::pair<T, T> feature_range(const DataSet<T>& data_set, SDIter first,
+                              SDIter last, FeatureIndex feature) {
+  const auto column = data_set.features.column(feature);
+  T low = column[*first];
+  T high = low;
+  for (auto sample = first; sample != last; ++sample) {
+    const T value = column[*sample];
+    low = std::min(low, value);
+    high = std::max(high, value);
+  }
+  return {low, high};
 }
 
 // Centers the dataset on a given mean vector.
-void zero_center_mean(DataSet& dataset, const std::vector<double>& means) {
-  for (auto& example : dataset) {
-    vector_minus(example.features, means);
-  }
+template <typename T>
+void zero_center_mean(DataSet<T>& dataset, const std::vector<double>& means) {
+  static_assert(std::is_floating_point<T>::value,
+                "centering requires floating point features");
+  dataset.features.for_each(
+      [&means](std::size_t, FeatureIndex feature, T& value) {
+        value -= means[feature];
+      });
 }
 
 // Centers the mean of the given dataset on 0.  Helps improve performance
 // and convergence speed of perceptron splitters.  Returns the mean vector.
-std::vector<double> zero_center_mean(DataSet& dataset) {
-  const auto n_features = dataset.front().features.size();
+template <typename T>
+std::vector<double> zero_center_mean(DataSet<T>& dataset) {
   const auto n_samples_real = static_cast<double>(dataset.size());
-  std::vector<double> means(n_features, 0);
+  std::vector<double> means(dataset.n_features(), 0);
 
-  for (const auto& example : dataset) {
-    for (auto feature = 0ul; feature < n_features; ++feature) {
-      means[feature] += example.features[feature];
-    }
-  }
+  dataset.features.for_each(
+      [&means](std::size_t, FeatureIndex feature, T value) {
+        means[feature] += value;
+      });
 
   for (auto& mean : means) {
     mean /= n_samples_real;
@@ -141,26 +398,26 @@ std::vector<double> zero_center_mean(DataSet& dataset) {
   return means;
 }
 
-void divide_stddev(DataSet& dataset, const std::vector<double>& stddevs) {
-  for (auto& example : dataset) {
-    for (auto feature = 0ul; feature < example.features.size(); ++feature) {
-      example.features[feature] /=
-          (stddevs[feature] == 0 ? 1 : stddevs[feature]);
-    }
-  }
+template <typename T>
+void divide_stddev(DataSet<T>& dataset, const std::vector<double>& stddevs) {
+  static_assert(std::is_floating_point<T>::value,
+                "scaling requires floating point features");
+  dataset.features.for_each(
+      [&stddevs](std::size_t, FeatureIndex feature, T& value) {
+        value /= (stddevs[feature] == 0 ? 1 : stddevs[feature]);
+      });
 }
 
 // Assumes 0 mean.
-std::vector<double> divide_stddev(DataSet& dataset) {
-  const auto n_features = dataset.front().features.size();
+template <typename T>
+std::vector<double> divide_stddev(DataSet<T>& dataset) {
   const auto n_samples_real = static_cast<double>(dataset.size());
-  std::vector<double> stddevs(n_features, 0);
+  std::vector<double> stddevs(dataset.n_features(), 0);
 
-  for (const auto& example : dataset) {
-    for (auto feature = 0ul; feature < n_features; ++feature) {
-      stddevs[feature] += example.features[feature] * example.features[feature];
-    }
-  }
+  dataset.features.for_each(
+      [&stddevs](std::size_t, FeatureIndex feature, T value) {
+        stddevs[feature] += static_cast<double>(value) * value;
+      });
 
   for (auto& stddev : stddevs) {
     stddev = std::sqrt(stddev / n_samples_real);
@@ -170,6 +427,256 @@ std::vector<double> divide_stddev(DataSet& dataset) {
   return stddevs;
 }
 
+// The mean and spread of every feature of a dataset, found in a single pass
+// with Welford's method.  Statistics of separate samples merge into those of
+// all of them, so they can be found in parallel.  The statistics of the
+// training set are kept to normalize the test set, and samples being served,
+// the same way.
+struct FeatureStats {
+  FeatureStats() = default;
+
+  explicit FeatureStats(std::size_t n_features)
+      : means(n_features, 0), squared_deviations(n_features, 0) {}
+
+  std::size_t n_features() const { return means.size(); }
+
+  // The population standard deviation, as divide_stddev uses.
+  double stddev(FeatureIndex feature) const {
+    return n_samples == 0 ? 0
+                          : std::sqrt(squared_deviations[feature] / n_samples);
+  }
+
+  std::vector<double> stddevs() const {
+    std::vector<double> ret(n_features());
+    for (auto feature = 0ul; feature < n_features(); ++feature) {
+      ret[feature] = stddev(feature);
+    }
+    return ret;
+  }
+
+  // Adds the statistics of other, which were found over other samples.
+  void merge(const FeatureStats& other) {
+    if (other.n_samples == 0) return;
+    if (n_samples == 0) {
+      *this = other;
+      return;
+    }
+    const double n = n_samples + other.n_samples;
+    const double other_weight = other.n_samples / n;
+    const double cross = static_cast<double>(n_samples) * other_weight;
+    for (auto feature = 0ul; feature < n_features(); ++feature) {
+      const auto delta = other.means[feature] - means[feature];
+      means[feature] += delta * other_weight;
+      squared_deviations[feature] +=
+          other.squared_deviations[feature] + delta * delta * cross;
+    }
+    n_samples += other.n_samples;
+  }
+
+  std::size_t n_samples = 0;
+  std::vector<double> means;
+  // The sum of squared differences from the mean of each feature.
+  std::vector<double> squared_deviations;
+};
+
+// Calls f(chunk, first, last) for consecutive ranges of samples which together
+// cover n_samples, as tasks on the thread pool if there is one.  Returns once
+// every call has finished, running other tasks while it waits, so it can be
+// called from a task.
+template <typename F>
+void for_each_sample_chunk(std::size_t n_samples,
+                           qp::threading::Threadpool* thread_pool, F&& f) {
+  // A few chunks per thread evens out threads which start late.
+  const auto n_chunks =
+      thread_pool == nullptr
+          ? 1
+          : std::max<std::size_t>(
+                std::min(4 * thread_pool->n_threads(), n_samples), 1);
+  const auto chunk_size = (n_samples + n_chunks - 1) / n_chunks;
+  if (n_chunks == 1) {
+    f(0, 0, n_samples);
+    return;
+  }
+
+  std::vector<std::future<void>> futures;
+  futures.reserve(n_chunks);
+  for (auto chunk = 0ul; chunk < n_chunks; ++chunk) {
+    const auto first = std::min(chunk * chunk_size, n_samples);
+    const auto last = std::min(first + chunk_size, n_samples);
+    futures.emplace_back(thread_pool->add(
+        [&f, chunk, first, last]() { f(chunk, first, last); }));
+  }
+  for (auto& future : futures) thread_pool->wait(future);
+}
+
+// Finds the statistics of the samples between first and last, reading them in
+// the order they are stored.
+template <typename T>
+FeatureStats feature_stats(const FeatureMatrix<T>& features,
+                           std::size_t first, std::size_t last) {
+  const auto n_features = features.n_features();
+  FeatureStats stats(n_features);
+  stats.n_samples = last - first;
+  auto* means = stats.means.data();
+  auto* squared_deviations = stats.squared_deviations.data();
+
+  if (features.layout() == Layout::ROW_MAJOR) {
+    for (auto sample = first; sample < last; ++sample) {
+      const auto* row = features.data() + sample * n_features;
+      const auto weight = 1.0 / (sample - first + 1);
+      for (auto feature = 0ul; feature < n_features; ++feature) {
+        const double value = row[feature];
+        const auto delta = value - means[feature];
+        means[feature] += delta * weight;
+        squared_deviations[feature] += delta * (value - means[feature]);
+      }
+    }
+    return stats;
+  }
+
+  // Updating the mean one value at a time divides by every value, so columns
+  // are read in blocks small enough to stay in cache.  Each block takes two
+  // passes, for its mean and then for its squared deviations, and is merged
+  // into the running statistics like a chunk.  The passes keep several sums
+  // so that they are not held up waiting on a single one.
+  constexpr std::size_t kBlockSize = 1024;
+  constexpr std::size_t kSums = 4;
+  for (auto feature = 0ul; feature < n_features; ++feature) {
+    const auto* column = features.data() + feature * features.n_samples();
+    double mean = 0, squared_deviation = 0;
+    for (auto block = first; block < last; block += kBlockSize) {
+      const auto block_end = std::min(block + kBlockSize, last);
+      const double n_block = block_end - block;
+      const auto unrolled_end = block_end - (block_end - block) % kSums;
+
+      std::array<double, kSums> sums = {};
+      for (auto sample = block; sample < unrolled_end; sample += kSums) {
+        for (auto i = 0ul; i < kSums; ++i) sums[i] += column[sample + i];
+      }
+      for (auto sample = unrolled_end; sample < block_end; ++sample) {
+        sums[0] += column[sample];
+      }
+      const auto block_mean =
+          std::accumulate(sums.begin(), sums.end(), 0.0) / n_block;
+
+      sums = {};
+      for (auto sample = block; sample < unrolled_end; sample += kSums) {
+        for (auto i = 0ul; i < kSums; ++i) {
+          const auto delta = column[sample + i] - block_mean;
+          sums[i] += delta * delta;
+        }
+      }
+      for (auto sample = unrolled_end; sample < block_end; ++sample) {
+        const auto delta = column[sample] - block_mean;
+        sums[0] += delta * delta;
+      }
+      const auto block_deviation =
+          std::accumulate(sums.begin(), sums.end(), 0.0);
+
+      const double n_before = block - first;
+      const auto delta = block_mean - mean;
+      mean += delta * n_block / (n_before + n_block);
+      squared_deviation += block_deviation + delta * delta * n_before *
+                                                 n_block /
+                                                 (n_before + n_block);
+    }
+    means[feature] = mean;
+    squared_deviations[feature] = squared_deviation;
+  }
+  return stats;
+}
+
+// Finds the statistics of every feature of the dataset in a single pass, in
+// parallel on the thread pool if there is one.
+template <typename T>
+FeatureStats feature_stats(const DataSet<T>& dataset,
+                           qp::threading::Threadpool* thread_pool = nullptr) {
+  std::vector<FeatureStats> chunks(
+      thread_pool == nullptr ? 1 : 4 * thread_pool->n_threads());
+  for_each_sample_chunk(
+      dataset.size(), thread_pool,
+      [&](std::size_t chunk, std::size_t first, std::size_t last) {
+        chunks[chunk] = feature_stats(dataset.features, first, last);
+      });
+
+  // Chunks are merged in order, so the result does not depend on the order
+  // in which they finished.
+  FeatureStats stats(dataset.n_features());
+  for (const auto& chunk : chunks) stats.merge(chunk);
+  return stats;
+}
+
+// The factor normalize scales each feature by.  Constant features are left
+// unscaled, as in divide_stddev.
+std::vector<double> normalize_scales(const FeatureStats& stats) {
+  auto scales = stats.stddevs();
+  for (auto& scale : scales) scale = scale == 0 ? 1 : 1 / scale;
+  return scales;
+}
+
+// Centers every feature of the dataset on the mean of stats and divides it by
+// the standard deviation, in a single pass.  This is zero_center_mean followed
+// by divide_stddev, for statistics which may come from another dataset.
+template <typename T>
+void normalize(DataSet<T>& dataset, const FeatureStats& stats,
+               qp::threading::Threadpool* thread_pool = nullptr) {
+  static_assert(std::is_floating_point<T>::value,
+                "normalizing requires floating point features");
+  assert(stats.n_features() == dataset.n_features());
+  const auto scales = normalize_scales(stats);
+  auto& features = dataset.features;
+  const auto n_features = features.n_features();
+
+  for_each_sample_chunk(
+      dataset.size(), thread_pool,
+      [&](std::size_t, std::size_t first, std::size_t last) {
+        if (features.layout() == Layout::ROW_MAJOR) {
+          for (auto sample = first; sample < last; ++sample) {
+            auto* row = features.data() + sample * n_features;
+            for (auto feature = 0ul; feature < n_features; ++feature) {
+              row[feature] = (row[feature] - stats.means[feature]) *
+                             scales[feature];
+            }
+          }
+          return;
+        }
+        for (auto feature = 0ul; feature < n_features; ++feature) {
+          auto* column = features.data() + feature * features.n_samples();
+          const auto mean = stats.means[feature];
+          const auto scale = scales[feature];
+          for (auto sample = first; sample < last; ++sample) {
+            column[sample] = (column[sample] - mean) * scale;
+          }
+        }
+      });
+}
+
+// Normalizes the dataset by its own statistics, which are returned so that
+// other data can be normalized the same way.  Takes two passes over the
+// dataset, against four for zero_center_mean and divide_stddev.
+template <typename T>
+FeatureStats normalize(DataSet<T>& dataset,
+                       qp::threading::Threadpool* thread_pool = nullptr) {
+  auto stats = feature_stats(dataset, thread_pool);
+  normalize(dataset, stats, thread_pool);
+  return stats;
+}
+
+// Normalizes the features of a single sample, such as one being served, by
+// the statistics of the data the forest was trained on.  It ends up exactly as
+// it would in a dataset normalized with them.
+template <typename T>
+void normalize(std::vector<T>& features, const FeatureStats& stats) {
+  static_assert(std::is_floating_point<T>::value,
+                "normalizing requires floating point features");
+  assert(stats.n_features() == features.size());
+  const auto scales = normalize_scales(stats);
+  for (auto feature = 0ul; feature < features.size(); ++feature) {
+    features[feature] =
+        (features[feature] - stats.means[feature]) * scales[feature];
+  }
+}
+
 }  // namespace rf
 }  // namespace qp
 #endif /* DATASET_H */
@@ -1,6 +1,8 @@
 #ifndef DEEP_FOREST_H
 #define DEEP_FOREST_H
 
+#include <type_traits>
+
 #include "dataset.h"
 #include "forest.h"
 #include "logging.h"
@@ -24,6 +26,10 @@ struct LayerConfig {
   // Threshold for being considered leaf
   int leaf_threshold;
 
+  // The fraction of the rows each tree is trained on, drawn without
+  // replacement.  One means a bootstrap sample, as in DecisionForest.
+  double sample_fraction = 1;
+
   // For convenience sake. Allows for things like:
   // vector<LayerConfig> hidden_layers = {
   //    {50, 2}, {100, 5}, {200, 8}
@@ -35,9 +41,16 @@ struct LayerConfig {
 };
 
 // A deep forest consists of layers of decision forests.  Each layer passes
-// a transformed feature vector to the next.
-template <typename SplitterFn>
+// a transformed feature vector to the next, with the index of the leaf each of
+// its trees reaches appended.  So that those indices are not truncated, T must
+// be a floating point type.  Every layer has ClassesT classes, and chooses
+// splits by CriterionT.
+template <typename SplitterFn, typename T = double,
+          typename ClassesT = Classes<>, typename CriterionT = Gini>
 class DeepForest {
+  static_assert(std::is_floating_point<T>::value,
+                "deep forests need floating point features");
+
  public:
   // Construct the forest based on the layer configurations.
   DeepForest(const LayerConfig& input_layer_config,
@@ -46,47 +59,49 @@ class DeepForest {
              qp::threading::Threadpool* thread_pool)
       : input_layer_(input_layer_config.trees, input_layer_config.depth,
                      thread_pool, input_layer_config.leaf_threshold,
-                     TreeType::DEEP_FOREST),
+                     TreeType::DEEP_FOREST, input_layer_config.sample_fraction),
         // The output layer can act as a single forest, as it performs no
         // transformations.
         output_layer_(output_layer_config.trees, output_layer_config.depth,
                       thread_pool, output_layer_config.leaf_threshold,
-                      TreeType::SINGLE_FOREST) {
+                      TreeType::SINGLE_FOREST,
+                      output_layer_config.sample_fraction) {
     hidden_layers_.reserve(hidden_layer_configs.size());
     for (const auto& config : hidden_layer_configs) {
       hidden_layers_.emplace_back(config.trees, config.depth, thread_pool,
-                                  config.leaf_threshold, TreeType::DEEP_FOREST);
+                                  config.leaf_threshold, TreeType::DEEP_FOREST,
+                                  config.sample_fraction);
     }
   }
 
   // Train the deep forest on the given dataset.
-  void train(const DataSet& data_set) {
+  void train(const DataSet<T>& data_set) {
     // TODO: can this be avoided?
     LOG << "copying dataset" << std::endl;
-    DataSet copy = data_set;
-    std::cout << copy.front().features.size() << " features" << std::endl;
+    DataSet<T> copy = data_set;
+    std::cout << copy.n_features() << " features" << std::endl;
     LOG << "training input layer" << std::endl;
     input_layer_.train(data_set);
     LOG << "transforming input layer" << std::endl;
     input_layer_.transform(copy);
 
     for (auto& layer : hidden_layers_) {
-      std::cout << copy.front().features.size() << " features" << std::endl;
+      std::cout << copy.n_features() << " features" << std::endl;
       LOG << "training hidden layer" << std::endl;
       layer.train(copy);
       LOG << "transforming data set" << std::endl;
       layer.transform(copy);
     }
 
-    std::cout << copy.front().features.size() << " features" << std::endl;
+    std::cout << copy.n_features() << " features" << std::endl;
     LOG << "training output layer" << std::endl;
     output_layer_.train(copy);
   }
 
   // Predict the label of a given feature set.
-  double predict(const std::vector<double>& features) {
+  double predict(FeatureView<T> features) {
     // TODO: can this be avoided?
-    auto copy = features;
+    auto copy = features.to_vector();
     input_layer_.transform(copy);
     for (unsigned i = 0; i < hidden_layers_.size(); ++i) {
       hidden_layers_[i].transform(copy);
@@ -94,10 +109,24 @@ class DeepForest {
     return output_layer_.predict(copy);
   }
 
+  // Predict the label of every sample of the dataset, passing the whole
+  // dataset through each layer in turn, with each layer's work spread across
+  // the thread pool.
+  std::vector<double> predict_batch(const DataSet<T>& data_set) const {
+    DataSet<T> copy = data_set;
+    input_layer_.transform(copy);
+    for (const auto& layer : hidden_layers_) {
+      layer.transform(copy);
+    }
+    return output_layer_.predict_batch(copy);
+  }
+
  private:
-  DecisionForest<SplitterFn> input_layer_;
-  std::vector<DecisionForest<SplitterFn>> hidden_layers_;
-  DecisionForest<SplitterFn> output_layer_;
+  using Forest = DecisionForest<SplitterFn, T, ClassesT, CriterionT>;
+
+  Forest input_layer_;
+  std::vector<Forest> hidden_layers_;
+  Forest output_layer_;
 };
 
 }  // namespace rf
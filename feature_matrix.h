@@ -0,0 +1,333 @@
+#ifndef FEATURE_MATRIX_H
+#define FEATURE_MATRIX_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+ * A dense matrix of feature values.  Each row of the matrix is a sample and
+ * each column is a feature.  All values live in a single aligned buffer, laid
+ * out either row by row or column by column.
+ */
+
+namespace qp {
+namespace rf {
+
+using FeatureIndex = std::size_t;
+
+// Feature buffers are aligned to a cache line, which is also wide enough for
+// any vector unit we are likely to run on.
+constexpr std::size_t kFeatureAlignment = 64;
+
+// An allocator which aligns every allocation to Alignment bytes.
+template <typename T, std::size_t Alignment = kFeatureAlignment>
+struct AlignedAllocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(std::size_t n) {
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, std::size_t) { std::free(ptr); }
+};
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return true;
+}
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return false;
+}
+
+// The order in which values are stored.  Column major keeps all the values of
+// a feature together, which is what split searches scan over.  Row major keeps
+// all the features of a sample together, which is what prediction reads.
+enum class Layout { ROW_MAJOR, COLUMN_MAJOR };
+
+// A read only view over a strided run of values in a feature matrix.  This is
+// either the features of a single sample, or the values of a single feature.
+template <typename T = double>
+class FeatureView {
+ public:
+  using value_type = T;
+
+  FeatureView(const T* data, std::size_t size, std::size_t stride)
+      : data_(data), size_(size), stride_(stride) {}
+
+  // Allows a plain feature vector to be used anywhere a view is expected.
+  FeatureView(const std::vector<T>& features)
+      : FeatureView(features.data(), features.size(), 1) {}
+
+  T operator[](std::size_t i) const { return data_[i * stride_]; }
+
+  std::size_t size() const { return size_; }
+
+  // Distance between consecutive values.  A stride of 1 means the view is
+  // contiguous and data() can be scanned directly.
+  std::size_t stride() const { return stride_; }
+
+  const T* data() const { return data_; }
+
+  std::vector<T> to_vector() const {
+    std::vector<T> ret(size_);
+    for (auto i = 0ul; i < size_; ++i) {
+      ret[i] = (*this)[i];
+    }
+    return ret;
+  }
+
+ private:
+  const T* data_;
+  std::size_t size_;
+  std::size_t stride_;
+};
+
+// Features are stored as T, which can be narrower than double when the data
+// allows it.  For example, pixel data fits in a uint8_t, which shrinks the
+// matrix by a factor of 8.
+template <typename T = double>
+class FeatureMatrix {
+ public:
+  using value_type = T;
+  using Buffer = std::vector<T, AlignedAllocator<T>>;
+
+  FeatureMatrix() : FeatureMatrix(0, 0) {}
+
+  // Creates a zero filled matrix.
+  FeatureMatrix(std::size_t n_samples, std::size_t n_features,
+                Layout layout = Layout::COLUMN_MAJOR)
+      : n_samples_(n_samples),
+        n_features_(n_features),
+        layout_(layout),
+        buffer_(n_samples * n_features, 0),
+        values_(buffer_.data()) {
+    compute_strides();
+  }
+
+  // Views values stored outside of the matrix, such as in a memory mapped
+  // file, without copying them.  storage keeps that memory alive for as long
+  // as the matrix refers to it.  The values are only copied into a buffer
+  // owned by the matrix if it is copied or changes shape.
+  FeatureMatrix(T* values, std::size_t n_samples, std::size_t n_features,
+                Layout layout, std::shared_ptr<void> storage)
+      : n_samples_(n_samples),
+        n_features_(n_features),
+        layout_(layout),
+        values_(values),
+        storage_(std::move(storage)) {
+    compute_strides();
+  }
+
+  // Copies always own their values, even if the source is a view.
+  FeatureMatrix(const FeatureMatrix<T>& other)
+      : n_samples_(other.n_samples_),
+        n_features_(other.n_features_),
+        layout_(other.layout_),
+        sample_stride_(other.sample_stride_),
+        feature_stride_(other.feature_stride_),
+        buffer_(other.values_, other.values_ + other.size()),
+        values_(buffer_.data()) {}
+
+  FeatureMatrix(FeatureMatrix<T>&& other) = default;
+
+  FeatureMatrix<T>& operator=(FeatureMatrix<T> other) {
+    std::swap(n_samples_, other.n_samples_);
+    std::swap(n_features_, other.n_features_);
+    std::swap(layout_, other.layout_);
+    std::swap(sample_stride_, other.sample_stride_);
+    std::swap(feature_stride_, other.feature_stride_);
+    std::swap(buffer_, other.buffer_);
+    std::swap(values_, other.values_);
+    std::swap(storage_, other.storage_);
+    return *this;
+  }
+
+  T& operator()(std::size_t sample, FeatureIndex feature) {
+    return values_[sample * sample_stride_ + feature * feature_stride_];
+  }
+
+  T operator()(std::size_t sample, FeatureIndex feature) const {
+    return values_[sample * sample_stride_ + feature * feature_stride_];
+  }
+
+  // The features of a single sample.
+  FeatureView<T> row(std::size_t sample) const {
+    return FeatureView<T>(values_ + sample * sample_stride_, n_features_,
+                          feature_stride_);
+  }
+
+  // The values of a single feature across all samples.
+  FeatureView<T> column(FeatureIndex feature) const {
+    return FeatureView<T>(values_ + feature * feature_stride_, n_samples_,
+                          sample_stride_);
+  }
+
+  // Calls f(sample, feature, value) for every value in the matrix, in the
+  // order they are stored.
+  template <typename F>
+  void for_each(F&& f) {
+    for_each_impl(*this, f);
+  }
+
+  template <typename F>
+  void for_each(F&& f) const {
+    for_each_impl(*this, f);
+  }
+
+  // Returns a copy of this matrix stored in the given layout.
+  FeatureMatrix<T> with_layout(Layout layout) const {
+    FeatureMatrix<T> ret(n_samples_, n_features_, layout);
+    for_each([&ret](std::size_t sample, FeatureIndex feature, T value) {
+      ret(sample, feature) = value;
+    });
+    return ret;
+  }
+
+  // Adds n zero valued features to the end of every sample.  This is cheap
+  // for column major matrices, since the new columns go at the end of the
+  // buffer.
+  void append_features(std::size_t n) {
+    if (layout_ == Layout::COLUMN_MAJOR) {
+      own();
+      n_features_ += n;
+      buffer_.resize(size(), 0);
+      values_ = buffer_.data();
+      return;
+    }
+
+    FeatureMatrix<T> widened(n_samples_, n_features_ + n, layout_);
+    for_each([&widened](std::size_t sample, FeatureIndex feature, T value) {
+      widened(sample, feature) = value;
+    });
+    *this = std::move(widened);
+  }
+
+  // Keeps only the first n samples.  This is cheap for row major matrices,
+  // since the dropped rows are at the end of the buffer.
+  void truncate_samples(std::size_t n) {
+    if (n >= n_samples_) return;
+
+    if (layout_ == Layout::ROW_MAJOR) {
+      own();
+      n_samples_ = n;
+      buffer_.resize(size());
+      values_ = buffer_.data();
+      return;
+    }
+
+    FeatureMatrix<T> truncated(n, n_features_, layout_);
+    for (auto feature = 0ul; feature < n_features_; ++feature) {
+      for (auto sample = 0ul; sample < n; ++sample) {
+        truncated(sample, feature) = (*this)(sample, feature);
+      }
+    }
+    *this = std::move(truncated);
+  }
+
+  // Copies n samples starting at sample from so that they start at sample to.
+  // Samples may only be moved towards the front of the matrix.
+  void move_samples(std::size_t from, std::size_t to, std::size_t n) {
+    if (layout_ == Layout::ROW_MAJOR) {
+      std::copy_n(values_ + from * n_features_, n * n_features_,
+                  values_ + to * n_features_);
+      return;
+    }
+
+    for (auto feature = 0ul; feature < n_features_; ++feature) {
+      auto* column = values_ + feature * n_samples_;
+      std::copy_n(column + from, n, column + to);
+    }
+  }
+
+  std::size_t n_samples() const { return n_samples_; }
+
+  std::size_t n_features() const { return n_features_; }
+
+  // Total number of values in the matrix.
+  std::size_t size() const { return n_samples_ * n_features_; }
+
+  Layout layout() const { return layout_; }
+
+  T* data() { return values_; }
+
+  const T* data() const { return values_; }
+
+  // Whether the values are stored outside of the matrix.
+  bool is_view() const { return storage_ != nullptr; }
+
+ private:
+  template <typename Matrix, typename F>
+  static void for_each_impl(Matrix& m, F& f) {
+    if (m.layout_ == Layout::ROW_MAJOR) {
+      for (auto sample = 0ul; sample < m.n_samples_; ++sample) {
+        for (auto feature = 0ul; feature < m.n_features_; ++feature) {
+          f(sample, feature, m(sample, feature));
+        }
+      }
+    } else {
+      for (auto feature = 0ul; feature < m.n_features_; ++feature) {
+        for (auto sample = 0ul; sample < m.n_samples_; ++sample) {
+          f(sample, feature, m(sample, feature));
+        }
+      }
+    }
+  }
+
+  void compute_strides() {
+    if (layout_ == Layout::ROW_MAJOR) {
+      sample_stride_ = n_features_;
+      feature_stride_ = 1;
+    } else {
+      sample_stride_ = 1;
+      feature_stride_ = n_samples_;
+    }
+  }
+
+  // Copies viewed values into the owned buffer.
+  void own() {
+    if (!is_view()) return;
+    buffer_.assign(values_, values_ + size());
+    values_ = buffer_.data();
+    storage_.reset();
+  }
+
+  std::size_t n_samples_;
+  std::size_t n_features_;
+  Layout layout_;
+  std::size_t sample_stride_;
+  std::size_t feature_stride_;
+
+  // Owned values.  Empty if the matrix is a view.
+  Buffer buffer_;
+  // Points to either buffer_ or the viewed values.
+  T* values_;
+  // Keeps viewed values alive.
+  std::shared_ptr<void> storage_;
+};
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* FEATURE_MATRIX_H */
@@ -1,10 +1,19 @@
 #ifndef FOREST_H
 #define FOREST_H
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
 #include <vector>
 
+#include "binning.h"
+#include "frozen_tree.h"
 #include "functional.h"
 #include "logging.h"
+#include "presorted.h"
+#include "sparse.h"
+#include "streaming.h"
 #include "threadpool.h"
 #include "tree.h"
 
@@ -13,8 +22,14 @@ namespace rf {
 
 // A collection of decision trees which each cast a vote towards the final
 // classification of a sample. Tree training is done on the provided thread
-// pool.
-template <typename SpiltterFn>
+// pool.  T is the type of the features the forest is trained on.  ClassesT is
+// the number of classes, which can be fixed at compile time as Classes<K> for
+// datasets with at most K distinct labels.  CriterionT is the impurity
+// criterion splits are chosen by: Gini, Entropy or Misclassification.
+// Splitters which score their own splits, such as BinnedUnivariateSplit, take
+// the criterion as their own parameter instead.
+template <typename SpiltterFn, typename T = double,
+          typename ClassesT = Classes<>, typename CriterionT = Gini>
 class DecisionForest {
  public:
   // Grow a forest of size |n_trees|, each of depth |max_depth|. Passing -1 as a
@@ -22,70 +37,144 @@ class DecisionForest {
   // whether the forest will be used in a deep forest or not (deep forest's
   // perform extra computations not needed within single forests).  Leaf
   // threshold defines the number of samples required to terminate the splitting
-  // of a node.
+  // of a node.  Each tree is trained on a bootstrap sample of the dataset, or
+  // if sample_fraction is less than one, on that fraction of the rows drawn
+  // without replacement.  Growth is the order each tree's nodes are trained
+  // in.
   DecisionForest(std::size_t n_trees, std::size_t max_depth,
                  qp::threading::Threadpool* thread_pool, int leaf_threshold = 1,
-                 TreeType tree_type = TreeType::SINGLE_FOREST)
-      : thread_pool_(thread_pool) {
+                 TreeType tree_type = TreeType::SINGLE_FOREST,
+                 double sample_fraction = 1,
+                 TreeGrowth growth = TreeGrowth::DEPTH_FIRST)
+      : thread_pool_(thread_pool), sample_fraction_(sample_fraction) {
+    assert(sample_fraction > 0 && sample_fraction <= 1);
     trees_.reserve(n_trees);
     for (unsigned i = 0; i < n_trees; ++i) {
-      trees_.emplace_back(max_depth, leaf_threshold, tree_type);
+      trees_.emplace_back(max_depth, leaf_threshold, tree_type, growth);
     }
   }
 
-  // Trains each tree in the forest on the provided dataset.  Tree training is
-  // done in parallel on the provided thread pool.
-  void train(const DataSet& data_set) {
-    qp::ProgressBar progress(trees_.size());
+  // Trains each tree in the forest on its own sample of the provided dataset.
+  // Tree training is done in parallel on the provided thread pool.
+  void train(const DataSet<T>& data_set) {
+    train_trees(data_set, nullptr, nullptr);
+  }
 
-    std::vector<std::future<void>> futures;
-    futures.reserve(trees_.size());
-    for (auto& tree : trees_) {
-      futures.emplace_back(thread_pool_->add([&data_set, &tree, this]() {
-        // Create a "sample" of the dataset so that each tree can re-arrange
-        // the order of the instances while leaving the original dataset intact.
-        auto sample = sample_exactly(data_set);
-        tree.train(sample);
-      }));
-    }
+  // Like train, but splitters look up feature ranges in presorted, which must
+  // have been built from data_set.  It can be shared by every forest trained
+  // on the same data.
+  void train(const DataSet<T>& data_set,
+             const PresortedFeatures<T>& presorted) {
+    train_trees(data_set, &presorted, nullptr);
+  }
 
-    // Thread pool futures are non-blocking.
-    for (auto& fut : futures) {
-      fut.wait();
-      progress.progress(1);
-    }
+  // Like train, but with the binned features of data_set, which splitters
+  // such as BinnedUnivariateSplit need.  They can be shared by every forest
+  // trained on the same data.
+  void train(const DataSet<T>& data_set, const BinnedFeatures<T>& binned) {
+    train_trees(data_set, nullptr, &binned);
+  }
+
+  // Like train, but on sparse features.  Splitters which support them, such
+  // as RandomUnivariateSplit and ExactUnivariateSplit, treat every value which
+  // is not stored as zero.
+  void train(const SparseDataSet<T>& data_set) {
+    train_trees(data_set, nullptr, nullptr);
   }
 
-  // Transform the feature vector.
+  // Trains each tree in the forest on samples streamed in chunks from source,
+  // such as a BinaryDataSource, for datasets which do not fit in memory.  At
+  // most memory_budget bytes of samples are held at once, on top of the
+  // sample indices and counts of each tree.  Only splitters made from a
+  // feature and a threshold can be trained this way.  Returns false if the
+  // source could not be read.
+  template <typename Source>
+  bool train(const Source& source, std::size_t memory_budget) {
+    StreamingTrainer<SpiltterFn, T, Source, ClassesT, CriterionT> trainer(
+        source, memory_budget, sample_fraction_, thread_pool_);
+    if (!trainer.train(trees_)) return false;
+    labels_ = trainer.labels();
+    freeze();
+    return true;
+  }
+
+  // Transform the feature vector.  Each tree appends the index of the leaf
+  // the sample reaches as a feature, which only floating point features hold
+  // exactly.
   // Note: This is experimental and only used for deep-rfs.
-  void transform(std::vector<double>& features) const {
+  void transform(std::vector<T>& features) const {
+    static_assert(std::is_floating_point<T>::value,
+                  "leaf indices need floating point features");
     for (auto i = 0UL; i < trees_.size(); ++i) {
-      features.push_back(trees_[i].transform_summation(features));
+      features.push_back(
+          static_cast<T>(trees_[i].transform_summation(features)));
     }
   }
 
-  // Transform an entire dataset of features.
+  // Transform an entire dataset of features, in blocks of samples across the
+  // thread pool like predict_batch.
   // Note: This is experimental and only used for deep-rfs.
-  void transform(DataSet& data_set) const {
-    for (auto sample = 0ul; sample < data_set.size(); ++sample) {
-      transform(data_set[sample].features);
-    }
+  void transform(DataSet<T>& data_set) const {
+    static_assert(std::is_floating_point<T>::value,
+                  "leaf indices need floating point features");
+    const auto n_original_features = data_set.n_features();
+    data_set.features.append_features(trees_.size());
+    for_each_sample_chunk(
+        data_set.size(), thread_pool_,
+        [&](std::size_t, std::size_t first, std::size_t last) {
+          for (auto i = 0UL; i < trees_.size(); ++i) {
+            for (auto sample = first; sample < last; ++sample) {
+              data_set.features(sample, n_original_features + i) =
+                  static_cast<T>(trees_[i].transform_summation(
+                      data_set.features.row(sample)));
+            }
+          }
+        });
   }
 
   // Predict the label of a set of features.  This is done by predicting the
   // label using each of the trees in the forest, and then taking the majority
-  // label over all trees.
-  double predict(const std::vector<double>& features) {
-    LabelHistogram predictions;
-    for (const auto& tree : trees_) {
-      ++predictions[tree.predict(features)];
-    }
+  // label over all trees.  Forests of univariate splits predict with frozen
+  // copies of their trees.
+  double predict(FeatureView<T> features) { return vote(features); }
+
+  double predict(const SparseRow<T>& features) { return vote(features); }
+
+  // Predict the label of every sample of the dataset at once.  Samples are
+  // split into blocks across the thread pool, and each tree predicts every
+  // sample of a block before the next tree starts, so that it stays in cache.
+  std::vector<double> predict_batch(const DataSet<T>& data_set) const {
+    std::vector<double> predictions(data_set.size());
+    predict_batch(data_set.features, predictions.data());
+    return predictions;
+  }
+
+  std::vector<double> predict_batch(const SparseDataSet<T>& data_set) const {
+    std::vector<double> predictions(data_set.size());
+    predict_batch(data_set.features, predictions.data());
+    return predictions;
+  }
 
-    auto prediction = std::max_element(predictions.begin(), predictions.end(),
-                                       CompareOnSecond<double, std::size_t>());
-    return prediction->first;
+  // Like predict_batch, but writes the label of each row of features to
+  // predictions, which must have room for them.
+  void predict_batch(const FeatureMatrix<T>& features,
+                     double* predictions) const {
+    predict_rows(features, predictions);
   }
 
+  void predict_batch(const SparseFeatureMatrix<T>& features,
+                     double* predictions) const {
+    predict_rows(features, predictions);
+  }
+
+  using Tree = DecisionTree<SpiltterFn, T, ClassesT, CriterionT>;
+
+  // The trained trees, for compiling into other forms such as QuickScorer.
+  const std::vector<Tree>& trees() const { return trees_; }
+
+  // The label of each class the trees predict.
+  const std::vector<double>& labels() const { return labels_; }
+
   // Determine the average depth of tree in the forest.  Just an interesting
   // stat to look at.
   double average_depth() const {
@@ -97,8 +186,117 @@ class DecisionForest {
   }
 
  private:
-  std::vector<DecisionTree<SpiltterFn>> trees_;
+  // Calls f on each tree predictions are made with, which are the frozen
+  // copies of the trees when they can be frozen.
+  template <typename F>
+  void for_each_predictor(F&& f) const {
+    if constexpr (IsUnivariateSplit<SpiltterFn>::value) {
+      for (const auto& tree : frozen_) f(tree);
+    } else {
+      for (const auto& tree : trees_) f(tree);
+    }
+  }
+
+  template <typename Features>
+  double vote(const Features& features) const {
+    typename ClassesT::Histogram predictions(labels_.size());
+    for_each_predictor([&](const auto& tree) {
+      ++predictions[tree.predict_class(features)];
+    });
+    return labels_[mode_class(predictions)];
+  }
+
+  // The number of samples whose votes are counted together.  A block's votes
+  // take this many times the number of classes, which stays in L1.
+  static constexpr std::size_t kPredictBlockSize = 256;
+
+  // Predicts every row of a dense or sparse feature matrix.  Ties between
+  // classes go the same way as in predict.
+  template <typename Matrix>
+  void predict_rows(const Matrix& features, double* predictions) const {
+    const auto n_classes = labels_.size();
+    for_each_sample_chunk(
+        features.n_samples(), thread_pool_,
+        [&](std::size_t, std::size_t chunk_first, std::size_t chunk_last) {
+          std::vector<std::uint32_t> votes(kPredictBlockSize * n_classes);
+          for (auto first = chunk_first; first < chunk_last;
+               first += kPredictBlockSize) {
+            const auto last = std::min(first + kPredictBlockSize, chunk_last);
+            std::fill(votes.begin(), votes.end(), 0);
+            for_each_predictor([&](const auto& tree) {
+              for (auto sample = first; sample < last; ++sample) {
+                ++votes[(sample - first) * n_classes +
+                        tree.predict_class(features.row(sample))];
+              }
+            });
+
+            for (auto sample = first; sample < last; ++sample) {
+              const auto* sample_votes =
+                  votes.data() + (sample - first) * n_classes;
+              predictions[sample] =
+                  labels_[std::max_element(sample_votes,
+                                           sample_votes + n_classes) -
+                          sample_votes];
+            }
+          }
+        });
+  }
+
+  // Copies the trained trees into the compact form predictions walk, for
+  // splitters which allow it.
+  void freeze() {
+    if constexpr (IsUnivariateSplit<SpiltterFn>::value) {
+      frozen_.clear();
+      frozen_.reserve(trees_.size());
+      for (const auto& tree : trees_) frozen_.emplace_back(tree);
+    }
+  }
+
+  template <typename DataSetT>
+  void train_trees(const DataSetT& data_set,
+                   const PresortedFeatures<T>* presorted,
+                   const BinnedFeatures<T>* binned) {
+    qp::ProgressBar progress(trees_.size());
+    // Labels are numbered once, and every tree shares the numbering.
+    const auto labels = encode_labels(data_set.labels);
+    labels_ = labels.values;
+
+    std::vector<std::future<void>> futures;
+    futures.reserve(trees_.size());
+    for (auto& tree : trees_) {
+      futures.emplace_back(
+          thread_pool_->add([&data_set, &labels, presorted, binned, &tree,
+                             this]() {
+            // Each tree gets its own sample, which it can re-arrange while
+            // leaving the original dataset intact.  Duplicate draws are kept
+            // as counts, so each row is only visited once.
+            SampleCounts counts;
+            auto sample =
+                sample_for_tree(data_set.size(), sample_fraction_, &counts);
+            // The tree may also split its own work across the pool, which
+            // keeps every thread busy when there are fewer trees than
+            // threads, or only a few slow ones left to finish.
+            tree.train(TrainingData<T, DataSetT>{data_set, labels, counts,
+                                                 presorted, binned},
+                       sample, thread_pool_);
+          }));
+    }
+
+    // Thread pool futures are non-blocking.
+    for (auto& fut : futures) {
+      fut.wait();
+      progress.progress(1);
+    }
+    freeze();
+  }
+
+  std::vector<Tree> trees_;
+  // The trees as predictions walk them, if they can be frozen.
+  std::vector<FrozenTree> frozen_;
   qp::threading::Threadpool* thread_pool_;
+  double sample_fraction_;
+  // The label of each class the trees predict.
+  std::vector<double> labels_;
 };
 
 }  // namespace rf
@@ -0,0 +1,106 @@
+#ifndef FROZEN_TREE_H
+#define FROZEN_TREE_H
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "dataset.h"
+#include "node.h"
+
+/*
+ * Frozen trees, for prediction.  A trained DecisionTree is a node per heap
+ * allocation, each holding its splitter and what training needed, so walking
+ * it misses the cache at nearly every level.  Freezing copies just what
+ * prediction reads into a single array of 16 byte nodes, laid out depth
+ * first so that a node's left child directly follows it, and the top levels
+ * of a tree share a handful of cache lines.
+ */
+
+namespace qp {
+namespace rf {
+
+// Splitters which send samples LEFT when a single feature is below a
+// threshold, and report them from feature_index() and threshold().  Trees
+// built from them can be frozen.
+template <typename SplitterFn, typename = void>
+struct IsUnivariateSplit : std::false_type {};
+
+template <typename SplitterFn>
+struct IsUnivariateSplit<
+    SplitterFn,
+    std::void_t<decltype(std::declval<const SplitterFn&>().feature_index()),
+                decltype(std::declval<const SplitterFn&>().threshold())>>
+    : std::true_type {};
+
+class FrozenTree {
+ public:
+  FrozenTree() = default;
+
+  // Copies a trained tree whose splitters are univariate.
+  template <typename Tree>
+  explicit FrozenTree(const Tree& tree) {
+    static_assert(IsUnivariateSplit<typename Tree::Splitter>::value,
+                  "only univariate splits can be frozen");
+    freeze(tree.root());
+  }
+
+  // Predict the class of a sample from its features, a FeatureView or a
+  // SparseRow, as the tree it was frozen from would.
+  template <typename Features>
+  ClassIndex predict_class(const Features& features) const {
+    const auto* nodes = nodes_.data();
+    auto current = 0u;
+    while (nodes[current].feature != kLeaf) {
+      const auto& node = nodes[current];
+      current =
+          features[node.feature] < node.threshold ? current + 1 : node.child;
+    }
+    return nodes[current].child;
+  }
+
+  // The number of nodes, leaves included.
+  std::size_t size() const { return nodes_.size(); }
+
+ private:
+  struct Node {
+    // The feature the node splits on, or kLeaf.
+    std::uint32_t feature;
+    // The position of the right child, or the class a leaf predicts.  The
+    // left child always follows its parent.
+    std::uint32_t child;
+    double threshold;
+  };
+
+  static constexpr std::uint32_t kLeaf =
+      std::numeric_limits<std::uint32_t>::max();
+
+  template <typename TreeNode>
+  void freeze(const TreeNode* node) {
+    const auto position = nodes_.size();
+    if (node->leaf()) {
+      nodes_.push_back({kLeaf, static_cast<std::uint32_t>(
+                                   node->predict_class()),
+                        0});
+      return;
+    }
+
+    const auto& splitter = node->splitter();
+    assert(splitter.feature_index() < kLeaf);
+    nodes_.push_back({static_cast<std::uint32_t>(splitter.feature_index()), 0,
+                      splitter.threshold()});
+    freeze(node->get_child(SplitDirection::LEFT));
+    assert(nodes_.size() < kLeaf);
+    nodes_[position].child = nodes_.size();
+    freeze(node->get_child(SplitDirection::RIGHT));
+  }
+
+  std::vector<Node> nodes_;
+};
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* FROZEN_TREE_H */
@@ -1,7 +1,9 @@
-#include <fstream>
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 #include "benchmark.h"
+#include "binary_dataset.h"
 #include "csv.h"
 #include "deep_forest.h"
 #include "forest.h"
@@ -12,21 +14,10 @@
 int main() {
   std::ios_base::sync_with_stdio(false);
 
-  std::ifstream training_stream("mnist_train.csv");
-  std::ifstream testing_stream("mnist_test.csv");
-
-  if (!training_stream || !testing_stream) {
-    std::cerr << "failed to open one of the files" << std::endl;
-    return 1;
-  }
-
-  qp::LOG << "reading data" << std::endl;
-  auto training = qp::rf::read_csv_data_set(training_stream, 60000, 784);
-  auto testing = qp::rf::read_csv_data_set(testing_stream, 10000, 784);
-
-  // Subtract mean.
-  const auto means = qp::rf::zero_center_mean(training);
-  qp::rf::zero_center_mean(testing, means);
+  // MNIST pixels are in [0, 255], so a byte per feature is enough.  Perceptron
+  // based splitters train better on zero centered data, so switch this to
+  // float and call qp::rf::normalize when using them.
+  using Feature = std::uint8_t;
 
   qp::LOG << "starting threadpool" << std::endl;
 #ifndef N_WORKERS
@@ -35,13 +26,42 @@ int main() {
   qp::threading::Threadpool thread_pool(N_WORKERS);
 #endif
 
+  // The csv files are converted to a binary cache the first time they are
+  // read, which later runs map directly.
+  qp::LOG << "reading data" << std::endl;
+  qp::rf::DataSet<Feature> training, testing;
+  std::vector<qp::rf::MalformedRow> training_errors, testing_errors;
+  if (!qp::rf::read_cached_csv_data_set("mnist_train.csv", "mnist_train.bin",
+                                        &thread_pool, &training,
+                                        &training_errors) ||
+      !qp::rf::read_cached_csv_data_set("mnist_test.csv", "mnist_test.bin",
+                                        &thread_pool, &testing,
+                                        &testing_errors)) {
+    std::cerr << "failed to open one of the files" << std::endl;
+    return 1;
+  }
+
+  for (const auto& row : training_errors) {
+    std::cerr << "mnist_train.csv:" << row.line << ": " << row.reason
+              << std::endl;
+  }
+  for (const auto& row : testing_errors) {
+    std::cerr << "mnist_test.csv:" << row.line << ": " << row.reason
+              << std::endl;
+  }
+  qp::LOG << training.size() << " training and " << testing.size()
+          << " testing samples with " << training.n_features() << " features"
+          << std::endl;
+
   qp::LOG << "evaluating classifier" << std::endl;
 
   // Create a classic random univariate forest which will be fully grown.
   // This template parameter can be replaced with any of those defined in
-  // split_fns.h to create different forests.
-  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit> forest(10, -1,
-                                                               &thread_pool);
+  // split_fns.h to create different forests.  MNIST has ten digits, so the
+  // number of classes is fixed at compile time.
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, Feature,
+                         qp::rf::Classes<10>>
+      forest(10, -1, &thread_pool);
 
   const auto results = qp::benchmark(forest, training, testing);
   std::cout << results << std::endl;
@@ -0,0 +1,120 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+
+/*
+ * Memory mapped files.  Mapping lets loaders parse a file in place, without
+ * copying it through a stream buffer first.
+ */
+
+namespace qp {
+namespace io {
+
+// How a file is mapped.  Copy on write mappings can be modified, but the
+// changes are private to the process and never reach the file.
+enum class MapMode { READ_ONLY, COPY_ON_WRITE };
+
+class MappedFile {
+ public:
+  // Maps the whole file into memory.  Like a std::ifstream, the object
+  // converts to false if the file could not be opened or mapped.
+  explicit MappedFile(const std::string& path,
+                      MapMode mode = MapMode::READ_ONLY);
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) { *this = std::move(other); }
+
+  MappedFile& operator=(MappedFile&& other);
+
+  // Unmaps the file.  Any pointers into it are invalidated.
+  ~MappedFile() { unmap(); }
+
+  explicit operator bool() const { return ok_; }
+
+  const char* begin() const { return data_; }
+
+  // Only writable if the file was mapped copy on write.
+  char* data() { return data_; }
+
+  const char* end() const { return data_ + size_; }
+
+  std::size_t size() const { return size_; }
+
+ private:
+  void unmap();
+
+  char* data_ = nullptr;
+  std::size_t size_ = 0;
+  bool ok_ = false;
+};
+
+MappedFile::MappedFile(const std::string& path, MapMode mode) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return;
+  }
+
+  size_ = info.st_size;
+  // Mapping an empty file is an error, but an empty file is still a valid
+  // (empty) file.
+  if (size_ > 0) {
+    const int protection =
+        mode == MapMode::READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+    void* mapping = mmap(nullptr, size_, protection, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      size_ = 0;
+      return;
+    }
+    // Read only files are parsed front to back, so let the kernel read ahead
+    // aggressively.  Copy on write files are used in place, and revisited in
+    // any order, so just ask for them to be paged in.
+    madvise(mapping, size_,
+            mode == MapMode::READ_ONLY ? MADV_SEQUENTIAL : MADV_WILLNEED);
+    data_ = static_cast<char*>(mapping);
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  ok_ = true;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+  if (this != &other) {
+    unmap();
+    data_ = other.data_;
+    size_ = other.size_;
+    ok_ = other.ok_;
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.ok_ = false;
+  }
+  return *this;
+}
+
+void MappedFile::unmap() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  ok_ = false;
+}
+
+}  // namespace io
+}  // namespace qp
+
+#endif /* MAPPED_FILE_H */
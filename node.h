@@ -3,9 +3,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <memory>
-#include <unordered_map>
+#include <type_traits>
+#include <vector>
 
 #include "criterion.h"
 #include "dataset.h"
@@ -17,79 +20,107 @@ namespace rf {
 // An enum defining split direction for a node.
 enum class SplitDirection { LEFT, RIGHT };
 
-// Represents a single node in a decision tree.
+// Splitters which score their own split while training, such as
+// BinnedUnivariateSplit, report its impurity from an impurity() method, or
+// infinity if the split does not separate the samples.  Nodes then use that
+// instead of sweeping the samples again to score each candidate.
+template <typename SplitterFn, typename = void>
+struct ScoresOwnSplit : std::false_type {};
+
 template <typename SplitterFn>
+struct ScoresOwnSplit<
+    SplitterFn,
+    std::void_t<decltype(std::declval<const SplitterFn&>().impurity())>>
+    : std::true_type {};
+
+// Represents a single node in a decision tree.  T is the type of the features
+// the node is trained on, ClassesT the number of classes, as Classes<K>, and
+// CriterionT the impurity criterion splits are chosen by, such as Gini.
+template <typename SplitterFn, typename T = double,
+          typename ClassesT = Classes<>, typename CriterionT = Gini>
 class DecisionNode {
  public:
+  using Histogram = typename ClassesT::Histogram;
+
   DecisionNode() : leaf_(false){};
 
-  // Train this node to decide on the dataset rows between start and end.
-  void train(SDIter first, SDIter last, int leaf_threshold) {
-    prediction_ = mode_label(first, last);
+  // Train this node to decide on the samples of the dataset between first and
+  // last.  Each sample is weighted by the number of times it was drawn.
+  void train(const TrainingData<T>& training, SDIter first, SDIter last,
+             int leaf_threshold) {
+    train<DataSet<T>>(training, first, last, leaf_threshold);
+  }
+
+  // Like train, but on a dense or sparse dataset.
+  template <typename DataSetT>
+  void train(const TrainingData<T, DataSetT>& training, SDIter first,
+             SDIter last, int leaf_threshold) {
+    const auto& data_set = training.data_set;
+    class_ =
+        mode_class<Histogram>(training.labels, training.counts, first, last);
+    prediction_ = training.labels.values[class_];
 
     // If the dataset only contains one label, or the number of samples
     // is less than the provided threshold than make it a leaf.
-    if (last - first <= leaf_threshold || single_label(first, last)) {
+    if (last - first <= leaf_threshold ||
+        single_label(data_set, first, last)) {
       make_leaf();
       return;
     }
 
     double min_impurity = std::numeric_limits<double>::max();
-    auto total_samples = static_cast<double>(last - first + 1);
 
     // Try different split functions and choose the one which results in the
     // least impurity.
-    const auto total_features = first->get().features.size();
-    int splits_to_try =
+    const auto total_features = data_set.n_features();
+    const int splits_to_try =
         std::sqrt(total_features) * splitter_.n_input_features();
 
     // Flag to tell us if we have actually split the data yet.
     bool actually_split = false;
 
-    // Try a minimum amount of times, but continue until we actually split the
-    // data.
-    while (splits_to_try > 0 || !actually_split) {
-      --splits_to_try;
-      SplitterFn candidate_split;
-      candidate_split.train(first, last);
-
-      // Generate histograms for the number of instances from each class which
-      // split left or right.
-      LabelHistogram went_left, went_right;
-      for (auto sample = first; sample != last; ++sample) {
-        if (candidate_split.apply(sample->get().features) ==
-            SplitDirection::LEFT) {
-          ++went_left[sample->get().label];
-        } else {
-          ++went_right[sample->get().label];
-        }
-      }
-
-      // At this point we know there are at least two labels, so we reject
-      // any split function which does not separate the input at all.
-      if (went_left.empty() || went_right.empty()) {
-        continue;
+    // Candidates are drawn in rounds, each scored together in a single sweep
+    // over the samples.  Keep drawing rounds until we actually split the
+    // data, but give up after many more tries, which happens when samples
+    // with different labels have the same features.
+    int attempts_left = kAttemptsPerCandidate * splits_to_try;
+    std::vector<SplitterFn> candidates;
+    std::vector<double> impurities;
+    while (!actually_split && attempts_left > 0) {
+      const auto n_candidates = std::min(splits_to_try, attempts_left);
+      attempts_left -= n_candidates;
+      candidates.resize(n_candidates);
+      for (auto& candidate : candidates) {
+        candidate.train(training, first, last);
       }
+      candidate_impurities(candidates, training, first, last, &impurities);
 
-      actually_split = true;
+      for (auto i = 0ul; i < candidates.size(); ++i) {
+        // At this point we know there are at least two labels, so we reject
+        // any split function which does not separate the input at all.
+        if (std::isinf(impurities[i])) {
+          continue;
+        }
 
-      // Calculate the total impurity as a weighted average of the left and
-      // right impurities.
-      auto left_impurity = gini_impurity(went_left);
-      auto right_impurity = gini_impurity(went_right);
-      auto total_impurity =
-          (left_impurity.first / total_samples) * left_impurity.second +
-          (right_impurity.first / total_samples) * right_impurity.second;
+        actually_split = true;
 
-      if (total_impurity < min_impurity) {
-        min_impurity = total_impurity;
-        splitter_ = std::move(candidate_split);
+        if (impurities[i] < min_impurity) {
+          min_impurity = impurities[i];
+          splitter_ = std::move(candidates[i]);
+        }
       }
+      candidates.clear();
+    }
+
+    if (!actually_split) {
+      make_leaf();
     }
   }
 
-  // Determine the direction of the split based on the features.
-  SplitDirection split_direction(const std::vector<double>& features) const {
+  // Determine the direction of the split based on the features, which are a
+  // FeatureView or a SparseRow.
+  template <typename Features>
+  SplitDirection split_direction(const Features& features) const {
     return splitter_.apply(features);
   }
 
@@ -97,37 +128,51 @@ class DecisionNode {
   // samples.
   double predict() const { return prediction_; }
 
+  // The class of the predicted label, in the encoding the node was trained
+  // with.
+  ClassIndex predict_class() const { return class_; }
+
+  const SplitterFn& splitter() const { return splitter_; }
+
+  // For trainers which choose the split and prediction themselves rather than
+  // calling train, such as the streaming trainer.
+  void set_splitter(SplitterFn splitter) { splitter_ = std::move(splitter); }
+
+  void set_prediction(ClassIndex prediction, double label) {
+    class_ = prediction;
+    prediction_ = label;
+  }
+
   // Whether or not this node is ready to predict.
   bool leaf() const { return leaf_; }
 
   void make_leaf() {
     leaf_ = true;
-    left_.reset();
-    right_.reset();
+    left_ = nullptr;
+    right_ = nullptr;
   }
 
-  // Allocate the child for the split direction and return a pointer to it.
-  // If the child already exists, it will be overwritten.
-  DecisionNode<SplitterFn>* make_child(SplitDirection dir) {
-    if (dir == SplitDirection::LEFT) {
-      left_.reset(new DecisionNode<SplitterFn>());
-      return left_.get();
-    } else {
-      right_.reset(new DecisionNode<SplitterFn>());
-      return right_.get();
-    }
+  // Set the child at the split direction, replacing any it already had.
+  // Nodes do not own their children: every node of a tree is owned by the
+  // tree's arena.
+  void set_child(SplitDirection dir, DecisionNode* child) {
+    (dir == SplitDirection::LEFT ? left_ : right_) = child;
   }
 
   // Get the child at the split direction.  Will return nullptr if the child
   // has not been allocated.
-  const DecisionNode<SplitterFn>* get_child(SplitDirection dir) const {
-    return dir == SplitDirection::LEFT ? left_.get() : right_.get();
+  const DecisionNode* get_child(SplitDirection dir) const {
+    return dir == SplitDirection::LEFT ? left_ : right_;
+  }
+
+  DecisionNode* get_child(SplitDirection dir) {
+    return dir == SplitDirection::LEFT ? left_ : right_;
   }
 
   // Get the activation value of the split function.
   // Note: this is experimental for deep-rfs, and only works if the splitter
   // is perceptron based.
-  double activation(const std::vector<double>& features) const {
+  double activation(FeatureView<T> features) const {
     return splitter_.activate(features);
   }
 
@@ -137,13 +182,71 @@ class DecisionNode {
   int index() const { return leaf_index_; }
 
  private:
-  std::unique_ptr<DecisionNode<SplitterFn>> left_, right_;
+  DecisionNode* left_ = nullptr;
+  DecisionNode* right_ = nullptr;
 
   double prediction_;
+  ClassIndex class_;
   SplitterFn splitter_;
   bool leaf_;
 
   int leaf_index_ = -1;
+
+  // How many times more than the usual number of candidates to try before
+  // giving up on splitting a node.
+  static constexpr int kAttemptsPerCandidate = 100;
+
+  // Finds the impurity of splitting the samples between first and last with
+  // each candidate, or infinity if it sends them all the same way.
+  template <typename DataSetT>
+  static void candidate_impurities(const std::vector<SplitterFn>& candidates,
+                                   const TrainingData<T, DataSetT>& training,
+                                   SDIter first, SDIter last,
+                                   std::vector<double>* impurities) {
+    impurities->clear();
+    if constexpr (ScoresOwnSplit<SplitterFn>::value) {
+      for (const auto& candidate : candidates) {
+        impurities->push_back(candidate.impurity());
+      }
+    } else {
+      // Count the instances from each class which split left for every
+      // candidate at once, so that each sample's features are read once
+      // rather than once per candidate.  The counts are kept class by class,
+      // as split_impurities scores them, and those which split right are
+      // what is left of each class.
+      const auto& data_set = training.data_set;
+      const auto& classes = training.labels.classes;
+      const auto& counts = training.counts;
+      const auto n_classes = training.labels.n_classes();
+      const auto n_candidates = candidates.size();
+      std::vector<double> went_left(n_classes * n_candidates),
+          went_right(n_classes * n_candidates);
+      Histogram total(n_classes);
+      for (auto sample = first; sample != last; ++sample) {
+        const auto features = data_set.features.row(*sample);
+        const auto label = classes[*sample];
+        const auto count = counts[*sample];
+        total[label] += count;
+        auto* left = went_left.data() + label * n_candidates;
+        for (auto i = 0ul; i < n_candidates; ++i) {
+          if (candidates[i].apply(features) == SplitDirection::LEFT) {
+            left[i] += count;
+          }
+        }
+      }
+
+      for (auto label = 0ul; label < n_classes; ++label) {
+        for (auto i = 0ul; i < n_candidates; ++i) {
+          went_right[label * n_candidates + i] =
+              total[label] - went_left[label * n_candidates + i];
+        }
+      }
+      impurities->resize(n_candidates);
+      split_impurities<CriterionT>(went_left.data(), went_right.data(),
+                                   n_classes, n_candidates,
+                                   impurities->data());
+    }
+  }
 };
 
 }  // namespace rf
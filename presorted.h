@@ -0,0 +1,172 @@
+#ifndef PRESORTED_H
+#define PRESORTED_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dataset.h"
+#include "threadpool.h"
+
+/*
+ * Presorted features.  The rows of a dataset are sorted by the value of each
+ * feature once, up front, so that the range of a feature among the samples of
+ * a node can usually be found without reading all of them.  Once built the
+ * structure is read only, so every tree of a forest can share it.  It takes 4
+ * bytes per value of the dataset, which is several times the size of the
+ * dataset itself for narrow feature types.
+ */
+
+namespace qp {
+namespace rf {
+
+template <typename T>
+class PresortedFeatures {
+ public:
+  // Sorts every feature of the dataset, one task per feature on the thread
+  // pool.
+  PresortedFeatures(const DataSet<T>& data_set,
+                    qp::threading::Threadpool* thread_pool);
+
+  // The rows of the dataset in increasing order of the feature's value.
+  const SampleIndex* order(FeatureIndex feature) const {
+    return orders_.data() + feature * n_samples_;
+  }
+
+  // The smallest and largest values of the feature over the whole dataset.
+  T low(FeatureIndex feature) const { return low_[feature]; }
+
+  T high(FeatureIndex feature) const { return high_[feature]; }
+
+  std::size_t n_samples() const { return n_samples_; }
+
+  std::size_t n_features() const { return n_features_; }
+
+  // The smallest and largest values of a feature among the samples between
+  // first and last, which must be distinct rows in increasing order.
+  std::pair<T, T> range(const DataSet<T>& data_set, SDIter first, SDIter last,
+                        FeatureIndex feature) const;
+
+ private:
+  void sort_feature(const DataSet<T>& data_set, FeatureIndex feature);
+
+  std::size_t n_samples_;
+  std::size_t n_features_;
+  // The sorted rows of every feature, one feature after another.
+  std::vector<SampleIndex> orders_;
+  std::vector<T> low_;
+  std::vector<T> high_;
+};
+
+template <typename T>
+PresortedFeatures<T>::PresortedFeatures(const DataSet<T>& data_set,
+                                        qp::threading::Threadpool* thread_pool)
+    : n_samples_(data_set.size()),
+      n_features_(data_set.n_features()),
+      orders_(n_samples_ * n_features_),
+      low_(n_features_),
+      high_(n_features_) {
+  std::vector<std::future<void>> futures;
+  futures.reserve(n_features_);
+  for (auto feature = 0ul; feature < n_features_; ++feature) {
+    futures.emplace_back(thread_pool->add(
+        [this, &data_set, feature]() { sort_feature(data_set, feature); }));
+  }
+
+  for (auto& fut : futures) {
+    fut.wait();
+  }
+}
+
+template <typename T>
+void PresortedFeatures<T>::sort_feature(const DataSet<T>& data_set,
+                                        FeatureIndex feature) {
+  if (n_samples_ == 0) return;
+
+  auto* order = orders_.data() + feature * n_samples_;
+  const auto column = data_set.features.column(feature);
+  if (std::is_integral<T>::value && sizeof(T) == 1) {
+    // Byte features have few enough values for a counting sort.
+    const auto key = [&column](SampleIndex row) {
+      return static_cast<std::size_t>(static_cast<int>(column[row]) -
+                                      std::numeric_limits<T>::min());
+    };
+    std::array<std::size_t, 257> starts = {};
+    for (auto row = 0ul; row < n_samples_; ++row) {
+      ++starts[key(row) + 1];
+    }
+    std::partial_sum(starts.begin(), starts.end(), starts.begin());
+    for (auto row = 0ul; row < n_samples_; ++row) {
+      order[starts[key(row)]++] = row;
+    }
+  } else {
+    std::iota(order, order + n_samples_, 0);
+    std::stable_sort(order, order + n_samples_,
+                     [&column](SampleIndex lhs, SampleIndex rhs) {
+                       return column[lhs] < column[rhs];
+                     });
+  }
+
+  low_[feature] = column[order[0]];
+  high_[feature] = column[order[n_samples_ - 1]];
+}
+
+template <typename T>
+std::pair<T, T> PresortedFeatures<T>::range(const DataSet<T>& data_set,
+                                            SDIter first, SDIter last,
+                                            FeatureIndex feature) const {
+  const auto n = static_cast<std::size_t>(last - first);
+  // A sample of every row covers the whole dataset.
+  if (n == n_samples_) return {low_[feature], high_[feature]};
+
+  // Otherwise scan in from both ends of the sorted order for the first row
+  // which is one of the samples.  Each probe is a binary search of the
+  // samples, so give up and read the samples directly once the probes would
+  // cost about as much.
+  const auto max_probes = static_cast<std::size_t>(n / (std::log2(n) + 1)) + 1;
+  const auto* order = this->order(feature);
+  const auto is_sample = [first, last](SampleIndex row) {
+    return std::binary_search(first, last, row);
+  };
+
+  auto probes = 0ul;
+  auto lowest = 0ul;
+  while (probes < max_probes && !is_sample(order[lowest])) {
+    ++probes;
+    ++lowest;
+  }
+  auto highest = n_samples_ - 1;
+  while (probes < max_probes && !is_sample(order[highest])) {
+    ++probes;
+    --highest;
+  }
+
+  if (probes >= max_probes) {
+    return feature_range(data_set, first, last, feature);
+  }
+
+  const auto column = data_set.features.column(feature);
+  return {column[order[lowest]], column[order[highest]]};
+}
+
+// The range of a feature among the samples between first and last, using the
+// presorted features when there are some.
+template <typename T>
+std::pair<T, T> feature_range(const TrainingData<T>& training, SDIter first,
+                              SDIter last, FeatureIndex feature) {
+  if (training.presorted != nullptr) {
+    return training.presorted->range(training.data_set, first, last, feature);
+  }
+  return feature_range(training.data_set, first, last, feature);
+}
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* PRESORTED_H */
@@ -0,0 +1,190 @@
+#ifndef QUICK_SCORER_H
+#define QUICK_SCORER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "dataset.h"
+#include "frozen_tree.h"
+#include "node.h"
+
+/*
+ * QuickScorer evaluates a forest of univariate splits without walking its
+ * trees.  Each tree's leaves are numbered left to right and tracked as a
+ * bitvector of those the sample could still reach.  A node whose test fails,
+ * sending the sample RIGHT, rules out the leaves of its left subtree, which
+ * are a run of consecutive bits.  The nodes of the whole forest are grouped
+ * by feature and sorted by threshold, so the failing nodes of a feature are
+ * exactly those before the first threshold above the sample's value.  After
+ * clearing the bits of every failing node, the lowest bit left in each tree's
+ * bitvector is the leaf the sample reaches.  The work is a few predictable
+ * loops over sorted arrays, rather than a branch per level of every tree.
+ *
+ * The cost grows with the number of failing nodes, about half of all nodes,
+ * where a walk's grows with the depth.  So it pays off for trees of up to
+ * about 64 leaves, a bitvector of a single word, and many trees over few
+ * features, where it scores about twice as fast as FrozenTree.  Deeper trees
+ * are supported, with several words per bitvector, but by depth 8 walking
+ * frozen trees is faster.
+ */
+
+namespace qp {
+namespace rf {
+
+class QuickScorer {
+ public:
+  // Compiles a trained forest of univariate splits.
+  template <typename Forest>
+  explicit QuickScorer(const Forest& forest) : labels_(forest.labels()) {
+    static_assert(IsUnivariateSplit<typename Forest::Tree::Splitter>::value,
+                  "only univariate splits can be scored");
+    std::vector<std::vector<Condition>> by_feature;
+    for (const auto& tree : forest.trees()) {
+      trees_.push_back({static_cast<std::uint32_t>(initial_.size()),
+                        static_cast<std::uint32_t>(leaf_classes_.size())});
+      const auto n_leaves =
+          add_tree(tree.root(), trees_.size() - 1, &by_feature);
+      const auto n_words = (n_leaves + 63) / 64;
+      for (auto word = 0ul; word < n_words; ++word) {
+        const auto bits = std::min<std::size_t>(n_leaves - 64 * word, 64);
+        initial_.push_back(bits == 64 ? ~std::uint64_t(0)
+                                      : (std::uint64_t(1) << bits) - 1);
+      }
+    }
+
+    feature_offsets_.push_back(0);
+    for (auto feature = 0ul; feature < by_feature.size(); ++feature) {
+      auto& conditions = by_feature[feature];
+      if (conditions.empty()) continue;
+      std::stable_sort(conditions.begin(), conditions.end(),
+                       [](const Condition& a, const Condition& b) {
+                         return a.threshold < b.threshold;
+                       });
+      features_.push_back(feature);
+      for (const auto& condition : conditions) {
+        thresholds_.push_back(condition.threshold);
+        const auto first_word = trees_[condition.tree].first_word;
+        ruled_out_.push_back({first_word + condition.first_leaf / 64,
+                              first_word + condition.last_leaf / 64,
+                              condition.first_leaf % 64,
+                              condition.last_leaf % 64});
+      }
+      feature_offsets_.push_back(thresholds_.size());
+    }
+  }
+
+  // Predict the label of a set of features, a FeatureView or a SparseRow, as
+  // the forest it was compiled from would.
+  template <typename Features>
+  double predict(const Features& features) const {
+    thread_local std::vector<std::uint64_t> leaves;
+    leaves = initial_;
+    for (auto i = 0ul; i < features_.size(); ++i) {
+      const double value = features[features_[i]];
+      for (auto condition = feature_offsets_[i];
+           condition < feature_offsets_[i + 1] &&
+           !(value < thresholds_[condition]);
+           ++condition) {
+        clear_leaves(leaves.data(), ruled_out_[condition]);
+      }
+    }
+
+    LabelHistogram votes(labels_.size());
+    for (const auto& tree : trees_) {
+      auto word = tree.first_word;
+      while (leaves[word] == 0) ++word;
+      const auto leaf =
+          64 * (word - tree.first_word) + __builtin_ctzll(leaves[word]);
+      ++votes[leaf_classes_[tree.first_leaf + leaf]];
+    }
+    return labels_[mode_class(votes)];
+  }
+
+ private:
+  // A node of a tree, which rules out the leaves of its left subtree when
+  // the sample's feature is not below the threshold.
+  struct Condition {
+    double threshold;
+    std::uint32_t tree;
+    // The leaves of the left subtree, numbered within the tree.
+    std::uint32_t first_leaf;
+    std::uint32_t last_leaf;
+  };
+
+  // The leaves a condition rules out, as the words of every tree's
+  // bitvectors holding the first and last of them, and their bits within
+  // those words.
+  struct LeafRange {
+    std::uint32_t first_word;
+    std::uint32_t last_word;
+    std::uint32_t first_bit;
+    std::uint32_t last_bit;
+  };
+
+  struct TreeLeaves {
+    // Where the tree's bitvector starts among the words of every tree.
+    std::uint32_t first_word;
+    // Where the tree's leaves start in leaf_classes_.
+    std::uint32_t first_leaf;
+  };
+
+  // Adds the conditions and leaves under node, numbering the leaves left to
+  // right from those already added for the tree.  Returns the number of
+  // leaves of the tree so far.
+  template <typename TreeNode>
+  std::uint32_t add_tree(const TreeNode* node, std::size_t tree,
+                         std::vector<std::vector<Condition>>* by_feature) {
+    if (node->leaf()) {
+      leaf_classes_.push_back(node->predict_class());
+      return leaf_classes_.size() - trees_[tree].first_leaf;
+    }
+
+    const auto first_leaf = leaf_classes_.size() - trees_[tree].first_leaf;
+    const auto n_left = add_tree(node->get_child(SplitDirection::LEFT), tree,
+                                 by_feature);
+    const auto& splitter = node->splitter();
+    if (by_feature->size() <= splitter.feature_index()) {
+      by_feature->resize(splitter.feature_index() + 1);
+    }
+    (*by_feature)[splitter.feature_index()].push_back(
+        {splitter.threshold(), static_cast<std::uint32_t>(tree),
+         static_cast<std::uint32_t>(first_leaf), n_left - 1});
+    return add_tree(node->get_child(SplitDirection::RIGHT), tree, by_feature);
+  }
+
+  // Clears the bits of a range of leaves.
+  static void clear_leaves(std::uint64_t* words, const LeafRange& range) {
+    const auto low = ~std::uint64_t(0) << range.first_bit;
+    const auto high = ~std::uint64_t(0) >> (63 - range.last_bit);
+    if (range.first_word == range.last_word) {
+      words[range.first_word] &= ~(low & high);
+      return;
+    }
+    words[range.first_word] &= ~low;
+    for (auto word = range.first_word + 1; word < range.last_word; ++word) {
+      words[word] = 0;
+    }
+    words[range.last_word] &= ~high;
+  }
+
+  std::vector<double> labels_;
+  std::vector<TreeLeaves> trees_;
+  // The bitvectors of every tree before any leaf is ruled out.
+  std::vector<std::uint64_t> initial_;
+  // The class each leaf predicts, tree after tree.
+  std::vector<ClassIndex> leaf_classes_;
+  // The features some node splits on, and the conditions on each, in
+  // increasing order of threshold, between consecutive feature_offsets_.
+  // The thresholds are kept apart from the leaves they rule out, so that
+  // finding the failing conditions reads as little as possible.
+  std::vector<FeatureIndex> features_;
+  std::vector<std::size_t> feature_offsets_;
+  std::vector<double> thresholds_;
+  std::vector<LeafRange> ruled_out_;
+};
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* QUICK_SCORER_H */
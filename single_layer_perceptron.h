@@ -58,7 +58,9 @@ class SingleLayerPerceptron {
   }
 
   // Given a set of features, return the activation values of the output layer.
-  std::vector<double> predict(const std::vector<double>& features) const {
+  // Features can be of any numeric type, but weights are always doubles.
+  template <typename T = double>
+  std::vector<double> predict(const std::vector<T>& features) const {
     std::vector<double> output(n_outputs_);
     for (auto i = 0ul; i < n_outputs_; ++i) {
       output[i] =
@@ -69,7 +71,8 @@ class SingleLayerPerceptron {
   }
 
   // Learn a training example and update the weights and biases accordingly.
-  void learn(const std::vector<double>& features,
+  template <typename T = double>
+  void learn(const std::vector<T>& features,
              const std::vector<double>& true_output) {
     const auto actual_output = predict(features);
     for (auto i = 0ul; i < n_outputs_; ++i) {
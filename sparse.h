@@ -0,0 +1,286 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "dataset.h"
+
+/*
+ * Sparse features, for datasets where most values are zero.  Only the
+ * non-zero values are stored, twice: row by row (CSR), which is what
+ * prediction and partitioning read, and column by column (CSC), which is what
+ * split searches over large nodes read.  Every value which is not stored is
+ * zero, and nothing ever fills them in, so memory and the cost of a split
+ * search grow with the number of non-zero values rather than the number of
+ * features.
+ */
+
+namespace qp {
+namespace rf {
+
+// The feature of a stored value.  Like sample indices these are 32 bits, so
+// that the index lists stay small.
+using SparseFeatureIndex = std::uint32_t;
+
+// A read only view of the features of a single sample.  Indexing it gives
+// zero for any feature which is not stored.
+template <typename T = double>
+class SparseRow {
+ public:
+  using value_type = T;
+
+  SparseRow(const SparseFeatureIndex* features, const T* values,
+            std::size_t n_nonzero, std::size_t n_features)
+      : features_(features),
+        values_(values),
+        n_nonzero_(n_nonzero),
+        n_features_(n_features) {}
+
+  T operator[](FeatureIndex feature) const {
+    const auto* found =
+        std::lower_bound(features_, features_ + n_nonzero_, feature);
+    return found != features_ + n_nonzero_ && *found == feature
+               ? values_[found - features_]
+               : T(0);
+  }
+
+  std::size_t size() const { return n_features_; }
+
+  // The stored features, in increasing order, and their values.
+  std::size_t n_nonzero() const { return n_nonzero_; }
+
+  const SparseFeatureIndex* features() const { return features_; }
+
+  const T* values() const { return values_; }
+
+  std::vector<T> to_vector() const {
+    std::vector<T> ret(n_features_, 0);
+    for (auto i = 0ul; i < n_nonzero_; ++i) {
+      ret[features_[i]] = values_[i];
+    }
+    return ret;
+  }
+
+ private:
+  const SparseFeatureIndex* features_;
+  const T* values_;
+  std::size_t n_nonzero_;
+  std::size_t n_features_;
+};
+
+// A read only view of the stored values of a single feature, with the samples
+// they belong to in increasing order.
+template <typename T = double>
+class SparseColumn {
+ public:
+  SparseColumn(const SampleIndex* samples, const T* values,
+               std::size_t n_nonzero)
+      : samples_(samples), values_(values), n_nonzero_(n_nonzero) {}
+
+  std::size_t n_nonzero() const { return n_nonzero_; }
+
+  const SampleIndex* samples() const { return samples_; }
+
+  const T* values() const { return values_; }
+
+ private:
+  const SampleIndex* samples_;
+  const T* values_;
+  std::size_t n_nonzero_;
+};
+
+template <typename T = double>
+class SparseFeatureMatrix {
+ public:
+  using value_type = T;
+
+  SparseFeatureMatrix() : SparseFeatureMatrix(0, {0}, {}, {}) {}
+
+  // Builds the matrix from its rows: the stored values of sample i are those
+  // between row_offsets[i] and row_offsets[i + 1] of features and values, with
+  // the features of each row in increasing order.  Explicit zeros are kept,
+  // though they need not be.
+  SparseFeatureMatrix(std::size_t n_features,
+                      std::vector<std::size_t> row_offsets,
+                      std::vector<SparseFeatureIndex> features,
+                      std::vector<T> values)
+      : n_features_(n_features),
+        row_offsets_(std::move(row_offsets)),
+        row_features_(std::move(features)),
+        row_values_(std::move(values)) {
+    assert(!row_offsets_.empty());
+    assert(row_features_.size() == row_values_.size());
+    assert(row_offsets_.back() == row_values_.size());
+    build_columns();
+  }
+
+  SparseRow<T> row(std::size_t sample) const {
+    const auto offset = row_offsets_[sample];
+    return SparseRow<T>(row_features_.data() + offset,
+                        row_values_.data() + offset,
+                        row_offsets_[sample + 1] - offset, n_features_);
+  }
+
+  SparseColumn<T> column(FeatureIndex feature) const {
+    const auto offset = column_offsets_[feature];
+    return SparseColumn<T>(column_samples_.data() + offset,
+                           column_values_.data() + offset,
+                           column_offsets_[feature + 1] - offset);
+  }
+
+  T operator()(std::size_t sample, FeatureIndex feature) const {
+    return row(sample)[feature];
+  }
+
+  std::size_t n_samples() const { return row_offsets_.size() - 1; }
+
+  std::size_t n_features() const { return n_features_; }
+
+  // The number of stored values.
+  std::size_t n_nonzero() const { return row_values_.size(); }
+
+ private:
+  // Transposes the rows into columns with a counting sort on the feature, so
+  // that the samples of each column end up in increasing order.
+  void build_columns() {
+    column_offsets_.assign(n_features_ + 1, 0);
+    for (const auto feature : row_features_) {
+      assert(feature < n_features_);
+      ++column_offsets_[feature + 1];
+    }
+    for (auto feature = 0ul; feature < n_features_; ++feature) {
+      column_offsets_[feature + 1] += column_offsets_[feature];
+    }
+
+    column_samples_.resize(n_nonzero());
+    column_values_.resize(n_nonzero());
+    auto next = column_offsets_;
+    for (auto sample = 0ul; sample < n_samples(); ++sample) {
+      for (auto i = row_offsets_[sample]; i < row_offsets_[sample + 1]; ++i) {
+        const auto position = next[row_features_[i]]++;
+        column_samples_[position] = sample;
+        column_values_[position] = row_values_[i];
+      }
+    }
+  }
+
+  std::size_t n_features_;
+  std::vector<std::size_t> row_offsets_;
+  std::vector<SparseFeatureIndex> row_features_;
+  std::vector<T> row_values_;
+  std::vector<std::size_t> column_offsets_;
+  std::vector<SampleIndex> column_samples_;
+  std::vector<T> column_values_;
+};
+
+// A dataset with sparse features.  Forests train on it and predict sparse
+// rows like they do dense ones, with univariate splitters such as
+// RandomUnivariateSplit and ExactUnivariateSplit.
+template <typename T = double>
+struct SparseDataSet {
+  using value_type = T;
+
+  SparseFeatureMatrix<T> features;
+  std::vector<double> labels;
+
+  std::size_t size() const { return labels.size(); }
+
+  std::size_t n_features() const { return features.n_features(); }
+};
+
+// Stores the non-zero values of a dense dataset sparsely.
+template <typename T>
+SparseDataSet<T> to_sparse(const DataSet<T>& data_set) {
+  std::vector<std::size_t> row_offsets = {0};
+  std::vector<SparseFeatureIndex> features;
+  std::vector<T> values;
+  for (auto sample = 0ul; sample < data_set.size(); ++sample) {
+    const auto row = data_set.features.row(sample);
+    for (auto feature = 0ul; feature < row.size(); ++feature) {
+      if (row[feature] != 0) {
+        features.push_back(feature);
+        values.push_back(row[feature]);
+      }
+    }
+    row_offsets.push_back(values.size());
+  }
+  return {SparseFeatureMatrix<T>(data_set.n_features(), std::move(row_offsets),
+                                 std::move(features), std::move(values)),
+          data_set.labels};
+}
+
+// Calls f(sample, value) for each stored value of a feature among the samples
+// between first and last, which must be distinct rows.  Large nodes read the
+// feature's column, marking their samples, and small ones search the row of
+// each sample, whichever reads fewer values.
+template <typename T, typename F>
+void for_each_nonzero(const SparseFeatureMatrix<T>& matrix, SDIter first,
+                      SDIter last, FeatureIndex feature, F&& f) {
+  const auto column = matrix.column(feature);
+  const auto n = static_cast<std::size_t>(last - first);
+  const auto row_search =
+      std::log2(static_cast<double>(matrix.n_nonzero()) /
+                    std::max<std::size_t>(matrix.n_samples(), 1) +
+                1) +
+      1;
+  if (column.n_nonzero() > n * row_search) {
+    for (auto sample = first; sample != last; ++sample) {
+      const auto value = matrix.row(*sample)[feature];
+      if (value != 0) f(*sample, value);
+    }
+    return;
+  }
+
+  thread_local std::vector<bool> in_node;
+  in_node.resize(matrix.n_samples());
+  for (auto sample = first; sample != last; ++sample) {
+    in_node[*sample] = true;
+  }
+  for (auto i = 0ul; i < column.n_nonzero(); ++i) {
+    if (in_node[column.samples()[i]] && column.values()[i] != 0) {
+      f(column.samples()[i], column.values()[i]);
+    }
+  }
+  for (auto sample = first; sample != last; ++sample) {
+    in_node[*sample] = false;
+  }
+}
+
+// The smallest and largest values of a feature among the samples between
+// first and last, counting the values which are not stored as zero.
+template <typename T>
+std::pair<T, T> feature_range(const SparseDataSet<T>& data_set, SDIter first,
+                              SDIter last, FeatureIndex feature) {
+  T low = 0, high = 0;
+  auto n_nonzero = 0ul;
+  for_each_nonzero(data_set.features, first, last, feature,
+                   [&](SampleIndex, T value) {
+                     low = n_nonzero == 0 ? value : std::min(low, value);
+                     high = n_nonzero == 0 ? value : std::max(high, value);
+                     ++n_nonzero;
+                   });
+  if (n_nonzero < static_cast<std::size_t>(last - first)) {
+    low = std::min<T>(low, 0);
+    high = std::max<T>(high, 0);
+  }
+  return {low, high};
+}
+
+// Sparse datasets are never presorted, so their ranges are always found from
+// the samples.
+template <typename T>
+std::pair<T, T> feature_range(const TrainingData<T, SparseDataSet<T>>& training,
+                              SDIter first, SDIter last,
+                              FeatureIndex feature) {
+  return feature_range(training.data_set, first, last, feature);
+}
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* SPARSE_H */
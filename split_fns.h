@@ -1,13 +1,23 @@
 #ifndef SPLIT_FNS_H
 #define SPLIT_FNS_H
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
 #include <experimental/optional>
-#include <map>
+#include <limits>
+#include <utility>
+#include <vector>
 
+#include "binning.h"
+#include "criterion.h"
 #include "dataset.h"
 #include "node.h"
+#include "presorted.h"
 #include "random.h"
 #include "single_layer_perceptron.h"
+#include "sparse.h"
 
 /*
  * A collection of split functions to use as weak learners inside of decision
@@ -18,10 +28,12 @@ namespace qp {
 namespace rf {
 
 // This class is totally symbolic.  Split functions should conform to this
-// interface.
+// interface.  The split functions below are not tied to a feature type, and
+// instead template train and apply so that they work with any T.
+template <typename T>
 class SplitFunction {
-  virtual void train(SDIter, SDIter) = 0;
-  virtual qp::rf::SplitDirection apply(const std::vector<double>&) const = 0;
+  virtual void train(const TrainingData<T>&, SDIter, SDIter) = 0;
+  virtual qp::rf::SplitDirection apply(FeatureView<T>) const = 0;
   virtual std::size_t n_input_features() const = 0;
 };
 
@@ -29,19 +41,209 @@ class SplitFunction {
 // and split on that.
 class RandomUnivariateSplit {
  public:
-  void train(SDIter first, SDIter last) {
-    const auto total_features = first->get().features.size();
+  RandomUnivariateSplit() = default;
+
+  // A split on a known feature and threshold, for trainers which pick them
+  // without calling train.
+  RandomUnivariateSplit(FeatureIndex feature_index, double threshold)
+      : feature_index_(feature_index), threshold_(threshold) {}
+
+  // Trains on dense or sparse features.
+  template <typename T, typename DataSetT>
+  void train(const TrainingData<T, DataSetT>& training, SDIter first,
+             SDIter last) {
+    const auto total_features = training.data_set.n_features();
     feature_index_ = random_range<FeatureIndex>(0, total_features - 1);
 
-    const auto feature_range = std::minmax_element(
-        first, last, qp::rf::CompareOnFeature<>(feature_index_));
+    const auto range = feature_range(training, first, last, feature_index_);
+    threshold_ = qp::rf::random_real_range<double>(range.first, range.second);
+  }
+
+  // features is a FeatureView or a SparseRow.
+  template <typename Features>
+  qp::rf::SplitDirection apply(const Features& features) const {
+    return features[feature_index_] < threshold_
+               ? qp::rf::SplitDirection::LEFT
+               : qp::rf::SplitDirection::RIGHT;
+  }
+
+  std::size_t n_input_features() const { return 1; }
+
+  FeatureIndex feature_index() const { return feature_index_; }
+
+  double threshold() const { return threshold_; }
+
+ private:
+  FeatureIndex feature_index_;
+  double threshold_;
+};
+
+// A univariate split which needs binned features in its training data.  Like
+// RandomUnivariateSplit it chooses a random feature, but rather than a random
+// threshold it counts the labels in each bin of the feature in one pass over
+// the samples, then takes the bin boundary with the least impurity under
+// CriterionT.  It scores itself, so nodes do not sweep the samples again to
+// compare candidates.
+template <typename CriterionT = Gini>
+class BinnedUnivariateSplit {
+ public:
+  template <typename T>
+  void train(const TrainingData<T>& training, SDIter first, SDIter last) {
+    assert(training.binned != nullptr);
+    const auto& binned = *training.binned;
+    feature_index_ = random_range<FeatureIndex>(0, binned.n_features() - 1);
+    impurity_ = std::numeric_limits<double>::infinity();
+
+    // The label counts of every bin, class by class, and the bins any sample
+    // falls in.  The counts are kept zeroed between calls by clearing only
+    // those bins, so small nodes do not pay for every bin of the feature.
+    const auto n_classes = training.labels.n_classes();
+    thread_local std::vector<std::size_t> histograms, total;
+    thread_local std::vector<Bin> occupied;
+    thread_local std::vector<double> went_left, went_right, impurities;
+    histograms.resize(kMaxBins * n_classes);
+    total.assign(n_classes, 0);
+    occupied.clear();
+
+    const auto* bins = binned.bins(feature_index_);
+    const auto& classes = training.labels.classes;
+    std::array<bool, kMaxBins> seen = {};
+    for (auto sample = first; sample != last; ++sample) {
+      const auto bin = bins[*sample];
+      const auto count = training.counts[*sample];
+      if (!seen[bin]) occupied.push_back(bin);
+      seen[bin] = true;
+      histograms[bin * n_classes + classes[*sample]] += count;
+      total[classes[*sample]] += count;
+    }
+    std::sort(occupied.begin(), occupied.end());
+
+    // Move bins to the left of the split one at a time, giving the counts
+    // either side of the boundary above each, class by class as
+    // split_impurities scores them.  Every sample is left of the boundary
+    // above the last bin, so it is not a candidate.
+    const auto n_boundaries = occupied.empty() ? 0 : occupied.size() - 1;
+    went_left.resize(n_classes * n_boundaries);
+    went_right.resize(n_classes * n_boundaries);
+    for (auto label = 0ul; label < n_classes; ++label) {
+      std::size_t left = 0;
+      for (auto i = 0ul; i < n_boundaries; ++i) {
+        left += histograms[occupied[i] * n_classes + label];
+        went_left[label * n_boundaries + i] = left;
+        went_right[label * n_boundaries + i] = total[label] - left;
+      }
+    }
+    for (const auto bin : occupied) {
+      std::fill_n(histograms.begin() + bin * n_classes, n_classes, 0);
+    }
+    if (n_boundaries == 0) return;
+
+    impurities.resize(n_boundaries);
+    split_impurities<CriterionT>(went_left.data(), went_right.data(),
+                                 n_classes, n_boundaries, impurities.data());
+    const auto best =
+        std::min_element(impurities.begin(), impurities.end()) -
+        impurities.begin();
+    impurity_ = impurities[best];
+    threshold_ = binned.lower_bound(feature_index_, occupied[best] + 1);
+  }
 
-    const auto low = feature_range.first->get().features[feature_index_];
-    const auto high = feature_range.second->get().features[feature_index_];
-    threshold_ = qp::rf::random_real_range<double>(low, high);
+  // features is a FeatureView or a SparseRow.
+  template <typename Features>
+  qp::rf::SplitDirection apply(const Features& features) const {
+    return features[feature_index_] < threshold_
+               ? qp::rf::SplitDirection::LEFT
+               : qp::rf::SplitDirection::RIGHT;
+  }
+
+  std::size_t n_input_features() const { return 1; }
+
+  FeatureIndex feature_index() const { return feature_index_; }
+
+  double threshold() const { return threshold_; }
+
+  // The impurity of the split on the samples it was trained on, or infinity
+  // if every sample fell in the same bin.
+  double impurity() const { return impurity_; }
+
+ private:
+  FeatureIndex feature_index_;
+  double threshold_;
+  double impurity_;
+};
+
+// A univariate split which chooses a random feature, then the threshold with
+// the least impurity under CriterionT.  It sorts the samples by the feature,
+// or reads them off the presorted order when the node holds enough of the
+// dataset that walking the whole order is cheaper than sorting, and scores
+// the boundary between every pair of distinct values from running label
+// counts.  Like BinnedUnivariateSplit it scores itself.  On sparse features
+// only the stored values are sorted, and the samples without one are moved
+// across the split together as zeros.
+template <typename CriterionT = Gini>
+class ExactUnivariateSplit {
+ public:
+  template <typename T, typename DataSetT>
+  void train(const TrainingData<T, DataSetT>& training, SDIter first,
+             SDIter last) {
+    const auto& data_set = training.data_set;
+    feature_index_ = random_range<FeatureIndex>(0, data_set.n_features() - 1);
+    impurity_ = std::numeric_limits<double>::infinity();
+
+    const auto n_classes = training.labels.n_classes();
+    const auto& classes = training.labels.classes;
+    const auto& counts = training.counts;
+    thread_local std::vector<double> left, total, not_stored;
+    left.assign(n_classes, 0);
+    total.assign(n_classes, 0);
+    for (auto sample = first; sample != last; ++sample) {
+      total[classes[*sample]] += counts[*sample];
+    }
+
+    thread_local std::vector<std::pair<T, SampleIndex>> sorted;
+    sort_samples(training, first, last, &sorted, &not_stored);
+
+    // Move samples to the left of the split in order, and take the boundary
+    // halfway to the next value as a candidate whenever it differs.
+    const auto move_left = [&](SampleIndex sample) {
+      if (sample == kNotStored) {
+        for (auto label = 0ul; label < n_classes; ++label) {
+          left[label] += not_stored[label];
+        }
+      } else {
+        left[classes[sample]] += counts[sample];
+      }
+    };
+
+    auto& block = candidate_block();
+    block.went_left.resize(n_classes * kBlockSize);
+    block.went_right.resize(n_classes * kBlockSize);
+    block.impurities.resize(kBlockSize);
+    block.thresholds.clear();
+    for (auto i = 0ul; i + 1 < sorted.size(); ++i) {
+      move_left(sorted[i].second);
+      if (!(sorted[i].first < sorted[i + 1].first)) continue;
+
+      const auto candidate = block.thresholds.size();
+      for (auto label = 0ul; label < n_classes; ++label) {
+        block.went_left[label * kBlockSize + candidate] = left[label];
+        block.went_right[label * kBlockSize + candidate] =
+            total[label] - left[label];
+      }
+      block.thresholds.push_back(static_cast<double>(sorted[i].first) / 2 +
+                                 static_cast<double>(sorted[i + 1].first) / 2);
+      if (block.thresholds.size() == kBlockSize) {
+        score_block(n_classes, &block);
+      }
+    }
+    if (!block.thresholds.empty()) {
+      score_block(n_classes, &block);
+    }
   }
 
-  qp::rf::SplitDirection apply(const std::vector<double>& features) const {
+  // features is a FeatureView or a SparseRow.
+  template <typename Features>
+  qp::rf::SplitDirection apply(const Features& features) const {
     return features[feature_index_] < threshold_
                ? qp::rf::SplitDirection::LEFT
                : qp::rf::SplitDirection::RIGHT;
@@ -49,9 +251,137 @@ class RandomUnivariateSplit {
 
   std::size_t n_input_features() const { return 1; }
 
+  FeatureIndex feature_index() const { return feature_index_; }
+
+  double threshold() const { return threshold_; }
+
+  // The impurity of the split on the samples it was trained on, or infinity
+  // if they all have the same value of the feature.
+  double impurity() const { return impurity_; }
+
  private:
+  // The number of candidate thresholds scored together.
+  static constexpr std::size_t kBlockSize = 64;
+
+  // Stands in for every sample whose value of a sparse feature is not stored.
+  static constexpr SampleIndex kNotStored =
+      std::numeric_limits<SampleIndex>::max();
+
+  // Candidate thresholds waiting to be scored, with the counts either side of
+  // each kept class by class, as split_impurities scores them: the count of
+  // class c for candidate i is at c * kBlockSize + i.
+  struct CandidateBlock {
+    std::vector<double> went_left, went_right, impurities, thresholds;
+  };
+
+  static CandidateBlock& candidate_block() {
+    thread_local CandidateBlock block;
+    return block;
+  }
+
+  // Fills sorted with the value of the feature and the row of each sample
+  // between first and last, in increasing order of value.
+  template <typename T>
+  void sort_samples(const TrainingData<T>& training, SDIter first,
+                    SDIter last, std::vector<std::pair<T, SampleIndex>>* sorted,
+                    std::vector<double>*) const {
+    const auto& data_set = training.data_set;
+    const auto column = data_set.features.column(feature_index_);
+    const auto n = static_cast<std::size_t>(last - first);
+    sorted->clear();
+    sorted->reserve(n);
+
+    if (training.presorted != nullptr &&
+        n * (std::log2(n) + 1) >= data_set.size()) {
+      // Mark the samples, then pick them out of the sorted order of every
+      // row.  The marks are cleared again for the next call.
+      thread_local std::vector<bool> in_node;
+      in_node.resize(data_set.size());
+      for (auto sample = first; sample != last; ++sample) {
+        in_node[*sample] = true;
+      }
+      const auto* order = training.presorted->order(feature_index_);
+      for (auto i = 0ul; i < data_set.size(); ++i) {
+        if (in_node[order[i]]) {
+          sorted->emplace_back(column[order[i]], order[i]);
+        }
+      }
+      for (auto sample = first; sample != last; ++sample) {
+        in_node[*sample] = false;
+      }
+      return;
+    }
+
+    for (auto sample = first; sample != last; ++sample) {
+      sorted->emplace_back(column[*sample], *sample);
+    }
+    sort_by_value(sorted);
+  }
+
+  // Like the above, but with a single zero valued entry of kNotStored for
+  // all the samples whose value is not stored, whose label counts are left
+  // in not_stored.
+  template <typename T>
+  void sort_samples(const TrainingData<T, SparseDataSet<T>>& training,
+                    SDIter first, SDIter last,
+                    std::vector<std::pair<T, SampleIndex>>* sorted,
+                    std::vector<double>* not_stored) const {
+    const auto& classes = training.labels.classes;
+    const auto& counts = training.counts;
+    not_stored->assign(training.labels.n_classes(), 0);
+    for (auto sample = first; sample != last; ++sample) {
+      (*not_stored)[classes[*sample]] += counts[*sample];
+    }
+
+    sorted->clear();
+    for_each_nonzero(training.data_set.features, first, last, feature_index_,
+                     [&](SampleIndex sample, T value) {
+                       sorted->emplace_back(value, sample);
+                       (*not_stored)[classes[sample]] -= counts[sample];
+                     });
+    if (sorted->size() < static_cast<std::size_t>(last - first)) {
+      sorted->emplace_back(T(0), kNotStored);
+    }
+    sort_by_value(sorted);
+  }
+
+  template <typename T>
+  static void sort_by_value(std::vector<std::pair<T, SampleIndex>>* sorted) {
+    std::sort(sorted->begin(), sorted->end(),
+              [](const std::pair<T, SampleIndex>& lhs,
+                 const std::pair<T, SampleIndex>& rhs) {
+                return lhs.first < rhs.first;
+              });
+  }
+
+  // Scores the candidates of the block, keeping the best seen so far, and
+  // empties it.
+  void score_block(std::size_t n_classes, CandidateBlock* block) {
+    const auto n = block->thresholds.size();
+    // Close the gaps a partly filled block leaves between classes.
+    for (auto label = 1ul; n < kBlockSize && label < n_classes; ++label) {
+      std::copy_n(block->went_left.begin() + label * kBlockSize, n,
+                  block->went_left.begin() + label * n);
+      std::copy_n(block->went_right.begin() + label * kBlockSize, n,
+                  block->went_right.begin() + label * n);
+    }
+
+    split_impurities<CriterionT>(block->went_left.data(),
+                                 block->went_right.data(), n_classes, n,
+                                 block->impurities.data());
+    const auto best = std::min_element(block->impurities.begin(),
+                                       block->impurities.begin() + n) -
+                      block->impurities.begin();
+    if (block->impurities[best] < impurity_) {
+      impurity_ = block->impurities[best];
+      threshold_ = block->thresholds[best];
+    }
+    block->thresholds.clear();
+  }
+
   FeatureIndex feature_index_;
   double threshold_;
+  double impurity_;
 };
 
 // Splits based on the sign of the dot product of a projection of the provided
@@ -63,17 +393,20 @@ class RandomMultivariateSplit {
   // random line.
   RandomMultivariateSplit() : line_(N, 1, 0) {}
 
-  void train(SDIter first, SDIter last) {
+  template <typename T>
+  void train(const TrainingData<T>& training, SDIter first, SDIter last) {
+    (void)first;
     (void)last;
 
     // Randomly select N features.
-    const auto total_features = first->get().features.size();
+    const auto total_features = training.data_set.n_features();
     generate_back_n(feature_indices_, N, [&]() {
       return random_range<FeatureIndex>(0, total_features - 1);
     });
   }
 
-  qp::rf::SplitDirection apply(const std::vector<double>& features) const {
+  template <typename T>
+  qp::rf::SplitDirection apply(FeatureView<T> features) const {
     return line_.predict(project(features, feature_indices_)).front() == 1
                ? qp::rf::SplitDirection::LEFT
                : qp::rf::SplitDirection::RIGHT;
@@ -94,28 +427,34 @@ class ModeVsAllPerceptronSplit {
  public:
   ModeVsAllPerceptronSplit() : layer_(N, 1, random_real_range<double>(0, 1)) {}
 
-  void train(SDIter first, SDIter last) {
+  template <typename T>
+  void train(const TrainingData<T>& training, SDIter first, SDIter last) {
+    const auto& data_set = training.data_set;
+
     // Randomly select features.
-    const auto total_features = first->get().features.size();
+    const auto total_features = data_set.n_features();
     generate_back_n(projection_, N, std::bind(random_range<FeatureIndex>, 0,
                                               total_features - 1));
 
     // Determine the mode laabel.
-    const auto should_fire = mode_label(first, last);
+    const auto& classes = training.labels.classes;
+    const auto should_fire = mode_class(training.labels, first, last);
     const std::vector<double> fire = {layer_.maximum_activation()};
     const std::vector<double> not_fire = {layer_.minimum_activation()};
 
     std::vector<double> input_buffer(N);
     for (auto example = first; example != last; ++example) {
-      project(example->get().features, projection_, input_buffer.begin());
+      project(data_set.features.row(*example), projection_,
+              input_buffer.begin());
       // If the example has the mode label then the perceptron should fire,
       // otherwise it should not.
       layer_.learn(input_buffer,
-                   example->get().label == should_fire ? fire : not_fire);
+                   classes[*example] == should_fire ? fire : not_fire);
     }
   }
 
-  qp::rf::SplitDirection apply(const std::vector<double>& features) const {
+  template <typename T>
+  qp::rf::SplitDirection apply(FeatureView<T> features) const {
     const auto input_buffer = project(features, projection_);
     const auto output_buffer = layer_.predict(input_buffer);
     return output_buffer.front() > layer_.fire_threshold()
@@ -125,8 +464,9 @@ class ModeVsAllPerceptronSplit {
 
   std::size_t n_input_features() const { return N; }
 
-  double activate(const std::vector<double>& features) const {
-    return layer_.predict(features).front();
+  template <typename T>
+  double activate(FeatureView<T> features) const {
+    return layer_.predict(project(features, projection_)).front();
   }
 
  private:
@@ -143,29 +483,35 @@ class ModeVsAllBlockPerceptronSplit {
       : layer_(BlockSize, 1, random_real_range<double>(0, 1)),
         block_buffer_(BlockSize) {}
 
-  void load_block(const std::vector<double>& features,
+  template <typename T>
+  void load_block(FeatureView<T> features,
                   std::vector<double>& buffer) const {
-    std::copy(features.begin() + block_start_,
-              features.begin() + block_start_ + BlockSize, buffer.begin());
+    for (auto i = 0ul; i < BlockSize; ++i) {
+      buffer[i] = features[block_start_ + i];
+    }
   }
 
-  void train(SDIter first, SDIter last) {
-    const auto total_features = first->get().features.size();
+  template <typename T>
+  void train(const TrainingData<T>& training, SDIter first, SDIter last) {
+    const auto& data_set = training.data_set;
+    const auto total_features = data_set.n_features();
     block_start_ =
         random_range<FeatureIndex>(0, total_features - 1 - BlockSize);
 
-    const auto should_fire = mode_label(first, last);
+    const auto& classes = training.labels.classes;
+    const auto should_fire = mode_class(training.labels, first, last);
     const std::vector<double> fire = {layer_.maximum_activation()};
     const std::vector<double> not_fire = {layer_.minimum_activation()};
 
     for (auto example = first; example != last; ++example) {
-      load_block(example->get().features, block_buffer_);
+      load_block(data_set.features.row(*example), block_buffer_);
       layer_.learn(block_buffer_,
-                   example->get().label == should_fire ? fire : not_fire);
+                   classes[*example] == should_fire ? fire : not_fire);
     }
   }
 
-  qp::rf::SplitDirection apply(const std::vector<double>& features) const {
+  template <typename T>
+  qp::rf::SplitDirection apply(FeatureView<T> features) const {
     load_block(features, block_buffer_);
     const auto output = layer_.predict(block_buffer_);
     return output.front() > layer_.fire_threshold()
@@ -190,46 +536,52 @@ class ModeVsAllBlockPerceptronSplit {
 template <typename Activation, int N>
 class HighestAverageActivation {
  public:
-  // Assign each label an incremental integer identifier.
-  std::map<double, int> label_identifiers(SDIter first, SDIter last) const {
-    std::map<double, int> ids;
+  // Assign each class among the samples an incremental integer identifier,
+  // and -1 to classes which do not occur.  Returns the number of identifiers.
+  int label_identifiers(const EncodedLabels& labels, SDIter first, SDIter last,
+                        std::vector<int>* ids) const {
+    ids->assign(labels.n_classes(), -1);
     int current_id = 0;
     for (auto i = first; i != last; ++i) {
-      const auto check = ids.insert({i->get().label, current_id});
-      if (check.second) ++current_id;
+      auto& id = (*ids)[labels.classes[*i]];
+      if (id < 0) id = current_id++;
     }
-    return ids;
+    return current_id;
   }
 
-  void train(SDIter first, SDIter last) {
+  template <typename T>
+  void train(const TrainingData<T>& training, SDIter first, SDIter last) {
+    const auto& data_set = training.data_set;
+
     // Randomly select features.
-    const auto total_features = first->get().features.size();
+    const auto total_features = data_set.n_features();
     generate_back_n(projection_, N, [total_features]() {
       return random_range<FeatureIndex>(0, total_features - 1);
     });
 
-    auto label_ids = label_identifiers(first, last);
+    std::vector<int> label_ids;
+    const auto n_ids =
+        label_identifiers(training.labels, first, last, &label_ids);
     layer_.reset(new SingleLayerPerceptron<Activation>(
-        N, label_ids.size(), random_real_range<double>(0, 1)));
+        N, n_ids, random_real_range<double>(0, 1)));
 
     // First pass train the perceptron.
-    std::vector<double> expected_output(label_ids.size(),
-                                        layer_->minimum_activation());
+    std::vector<double> expected_output(n_ids, layer_->minimum_activation());
     std::vector<double> projected(N);
     for (auto example = first; example != last; ++example) {
-      const auto label_id = label_ids[example->get().label];
+      const auto label_id = label_ids[training.labels.classes[*example]];
       expected_output[label_id] = layer_->maximum_activation();
-      project(example->get().features, projection_, projected.begin());
+      project(data_set.features.row(*example), projection_, projected.begin());
       layer_->learn(projected, expected_output);
       expected_output[label_id] = layer_->minimum_activation();
     }
 
     // Second pass determine which output neuron contains the maximum average
     // activation value.
-    std::vector<double> average_activations(label_ids.size(), 0);
+    std::vector<double> average_activations(n_ids, 0);
     double n_samples_real = static_cast<double>(last - first + 1);
     for (auto example = first; example != last; ++example) {
-      project(example->get().features, projection_, projected.begin());
+      project(data_set.features.row(*example), projection_, projected.begin());
       const auto output = layer_->predict(projected);
       for (auto activation = 0ul; activation < output.size(); ++activation) {
         average_activations[activation] += output[activation];
@@ -247,7 +599,8 @@ class HighestAverageActivation {
 
   // Determine the split direction based on the output of the maximum activation
   // neuron determined during the activation pass.
-  qp::rf::SplitDirection apply(const std::vector<double>& features) const {
+  template <typename T>
+  qp::rf::SplitDirection apply(FeatureView<T> features) const {
     const auto projected = project(features, projection_);
     const auto output = layer_->predict(projected);
     return output[maximum_activation_neuron_] > layer_->fire_threshold()
@@ -255,7 +608,8 @@ class HighestAverageActivation {
                : qp::rf::SplitDirection::RIGHT;
   }
 
-  double activate(const std::vector<double>& features) const {
+  template <typename T>
+  double activate(FeatureView<T> features) const {
     return layer_->predict(
         project(features, projection_))[maximum_activation_neuron_];
   }
@@ -278,7 +632,8 @@ class RandomSplitFunction {
   template <typename T>
   using Maybe = std::experimental::optional<T>;
 
-  void train(SDIter first, SDIter last) {
+  template <typename T>
+  void train(const TrainingData<T>& training, SDIter first, SDIter last) {
     const int random = random_range(0, 3);
     if (random == 0) {
       split_fn_1 = RandomUnivariateSplit();
@@ -290,13 +645,14 @@ class RandomSplitFunction {
       split_fn_4 = HighestAverageActivation<Activation, N>();
     }
 
-    if (split_fn_1) split_fn_1->train(first, last);
-    if (split_fn_2) split_fn_2->train(first, last);
-    if (split_fn_3) split_fn_3->train(first, last);
-    if (split_fn_4) split_fn_4->train(first, last);
+    if (split_fn_1) split_fn_1->train(training, first, last);
+    if (split_fn_2) split_fn_2->train(training, first, last);
+    if (split_fn_3) split_fn_3->train(training, first, last);
+    if (split_fn_4) split_fn_4->train(training, first, last);
   }
 
-  qp::rf::SplitDirection apply(const std::vector<double>& features) const {
+  template <typename T>
+  qp::rf::SplitDirection apply(FeatureView<T> features) const {
     if (split_fn_1) return split_fn_1->apply(features);
     if (split_fn_2) return split_fn_2->apply(features);
     if (split_fn_3) return split_fn_3->apply(features);
@@ -0,0 +1,462 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "criterion.h"
+#include "dataset.h"
+#include "random.h"
+#include "threadpool.h"
+#include "tree.h"
+
+/*
+ * Out of core training, for datasets which do not fit in memory.  Samples are
+ * streamed in chunks from a source such as a BinaryDataSource, and all the
+ * trees of a forest are grown together a level at a time.  A node being grown
+ * only keeps the indices of its samples, and its split is chosen from label
+ * histograms accumulated while streaming.  Once the samples of a node fit in
+ * the memory budget they are gathered into a DataSet and the rest of its
+ * subtree is trained in memory as usual.  Like in memory training, each tree
+ * is grown from its own sample of the rows, kept as a count per row.  The
+ * labels are numbered in a first pass over the data.
+ *
+ * A source provides size(), n_features() and read(first, n, chunk), which
+ * fills the first n rows of a row major DataSet with samples [first,
+ * first + n).
+ */
+
+namespace qp {
+namespace rf {
+
+// A node which finds no split that separates its samples is retried with new
+// candidates this many times before it becomes a leaf.  In memory training
+// retries until it succeeds, but each retry costs two passes over the data
+// here.
+constexpr int kStreamingSplitAttempts = 8;
+
+template <typename SplitterFn, typename T, typename Source,
+          typename ClassesT = Classes<>, typename CriterionT = Gini>
+class StreamingTrainer {
+  static_assert(std::is_constructible<SplitterFn, FeatureIndex, double>::value,
+                "streaming training needs a splitter made from a feature and "
+                "a threshold, such as RandomUnivariateSplit");
+
+ public:
+  using Tree = DecisionTree<SplitterFn, T, ClassesT, CriterionT>;
+  using Node = DecisionNode<SplitterFn, T, ClassesT, CriterionT>;
+  using Histogram = typename ClassesT::Histogram;
+
+  // At most memory_budget bytes of samples are held at once.  The sample
+  // indices and counts of each tree are not included.  Trees are sampled as
+  // by sample_for_tree.
+  StreamingTrainer(const Source& source, std::size_t memory_budget,
+                   double sample_fraction,
+                   qp::threading::Threadpool* thread_pool)
+      : source_(source),
+        sample_fraction_(sample_fraction),
+        thread_pool_(thread_pool) {
+    const auto sample_bytes = source.n_features() * sizeof(T) + sizeof(double);
+    const auto budget_samples =
+        std::max<std::size_t>(memory_budget / sample_bytes, 2);
+    // A quarter of the budget buffers the chunk being streamed, and the rest
+    // holds the samples of nodes being trained in memory.
+    chunk_samples_ = std::min(std::max<std::size_t>(budget_samples / 4, 1),
+                              std::max<std::size_t>(source.size(), 1));
+    gather_samples_ = budget_samples - chunk_samples_;
+    chunk_ = empty_data_set<T>(chunk_samples_, source.n_features(),
+                               Layout::ROW_MAJOR);
+    chunk_classes_.resize(chunk_samples_);
+  }
+
+  // Grows every tree from scratch.  Returns false if the source could not be
+  // read.
+  bool train(std::vector<Tree>& trees) {
+    if (!find_labels()) return false;
+
+    counts_.resize(trees.size());
+    for (auto i = 0ul; i < trees.size(); ++i) {
+      auto sample =
+          sample_for_tree(source_.size(), sample_fraction_, &counts_[i]);
+      schedule(PendingNode(&trees[i], trees[i].reset_root(), &counts_[i], 0,
+                           std::move(sample)));
+    }
+
+    while (!growing_.empty() || !gathering_.empty()) {
+      if (!grow_level() || !train_gathered()) return false;
+    }
+    return true;
+  }
+
+  // The label of each class the trees predict, once trained.
+  const std::vector<double>& labels() const { return labels_.values; }
+
+ private:
+  // A random univariate split being considered for a node.
+  struct Candidate {
+    // A candidate on feature, whose range and threshold are yet to be found.
+    Candidate(FeatureIndex feature, std::size_t n_classes)
+        : feature(feature), went_left(n_classes), went_right(n_classes) {}
+
+    FeatureIndex feature;
+    double low = std::numeric_limits<double>::max();
+    double high = std::numeric_limits<double>::lowest();
+    double threshold = 0;
+    Histogram went_left;
+    Histogram went_right;
+  };
+
+  struct PendingNode {
+    PendingNode(Tree* tree, Node* node, const SampleCounts* counts, int depth,
+                SampledDataSet samples)
+        : tree(tree),
+          node(node),
+          counts(counts),
+          depth(depth),
+          samples(std::move(samples)) {}
+
+    Tree* tree;
+    Node* node;
+    // The number of times each row was drawn into the tree's sample.
+    const SampleCounts* counts;
+    int depth;
+    // Indices of the samples which reach the node, in increasing order.
+    SampledDataSet samples;
+
+    int attempts = 0;
+    Histogram labels;
+    std::vector<Candidate> candidates;
+    // Positions of the children in the next level, once split.
+    std::size_t left = 0;
+    std::size_t right = 0;
+
+    // Samples gathered for in memory training, their classes and their
+    // counts.
+    DataSet<T> data;
+    EncodedLabels data_labels;
+    SampleCounts data_counts;
+    std::size_t n_gathered = 0;
+  };
+
+  // Reads every label of the source to number them.
+  bool find_labels() {
+    auto& values = labels_.values;
+    values.clear();
+    for (auto first = 0ul; first < source_.size(); first += chunk_samples_) {
+      const auto n = std::min(chunk_samples_, source_.size() - first);
+      if (!source_.read(first, n, &chunk_)) return false;
+      for (auto i = 0ul; i < n; ++i) {
+        const auto label = chunk_.labels[i];
+        const auto position =
+            std::lower_bound(values.begin(), values.end(), label);
+        if (position == values.end() || *position != label) {
+          values.insert(position, label);
+        }
+      }
+    }
+    return true;
+  }
+
+  // Nodes whose samples fit in the budget are trained in memory, and the rest
+  // are grown from the stream.
+  void schedule(PendingNode&& node) {
+    if (node.samples.size() <= gather_samples_) {
+      gathering_.push_back(std::move(node));
+    } else {
+      growing_.push_back(std::move(node));
+    }
+  }
+
+  // Grows each node in growing_ by one level.  This takes three passes over
+  // the data: one for the label counts and candidate feature ranges, one for
+  // the candidate split histograms, and one to partition the samples between
+  // the children.
+  bool grow_level() {
+    if (growing_.empty()) return true;
+    auto level = std::move(growing_);
+    growing_.clear();
+
+    const auto n_features = source_.n_features();
+    const auto n_classes = labels_.n_classes();
+    const auto n_candidates =
+        std::max<std::size_t>(std::sqrt(n_features), 1);
+    std::vector<PendingNode*> nodes;
+    for (auto& node : level) {
+      node.labels = Histogram(n_classes);
+      node.candidates.clear();
+      for (auto i = 0ul; i < n_candidates; ++i) {
+        node.candidates.emplace_back(
+            random_range<FeatureIndex>(0, n_features - 1), n_classes);
+      }
+      nodes.push_back(&node);
+    }
+
+    const auto ranged = stream(nodes, [](PendingNode& node,
+                                         FeatureView<T> features,
+                                         ClassIndex label, SampleIndex sample) {
+      node.labels[label] += (*node.counts)[sample];
+      for (auto& candidate : node.candidates) {
+        const double value = features[candidate.feature];
+        candidate.low = std::min(candidate.low, value);
+        candidate.high = std::max(candidate.high, value);
+      }
+    });
+    if (!ranged) return false;
+
+    // The same stopping rules as DecisionNode::train and DecisionTree.
+    std::vector<PendingNode*> splitting;
+    for (auto* node : nodes) {
+      auto& tree = *node->tree;
+      tree.record_depth(node->depth);
+      const auto prediction = mode_class(node->labels);
+      node->node->set_prediction(prediction, labels_.values[prediction]);
+      const auto single_label =
+          node->labels[prediction] == node->labels.total();
+      if (static_cast<int>(node->samples.size()) <= tree.leaf_threshold() ||
+          single_label || node->depth == tree.max_depth()) {
+        tree.finish_leaf(node->node);
+        continue;
+      }
+
+      for (auto& candidate : node->candidates) {
+        candidate.threshold =
+            random_real_range<double>(candidate.low, candidate.high);
+      }
+      splitting.push_back(node);
+    }
+
+    const auto scored = stream(splitting, [](PendingNode& node,
+                                             FeatureView<T> features,
+                                             ClassIndex label,
+                                             SampleIndex sample) {
+      const auto count = (*node.counts)[sample];
+      for (auto& candidate : node.candidates) {
+        if (features[candidate.feature] < candidate.threshold) {
+          candidate.went_left[label] += count;
+        } else {
+          candidate.went_right[label] += count;
+        }
+      }
+    });
+    if (!scored) return false;
+
+    std::vector<PendingNode> children;
+    std::vector<PendingNode*> split;
+    for (auto* node : splitting) {
+      const Candidate* best = nullptr;
+      double min_impurity = std::numeric_limits<double>::max();
+      for (const auto& candidate : node->candidates) {
+        // Reject any candidate which does not separate the samples at all.
+        if (candidate.went_left.total() == 0 ||
+            candidate.went_right.total() == 0) {
+          continue;
+        }
+
+        const auto impurity =
+            split_impurity<CriterionT>(candidate.went_left,
+                                       candidate.went_right);
+        if (impurity < min_impurity) {
+          min_impurity = impurity;
+          best = &candidate;
+        }
+      }
+
+      if (best == nullptr) {
+        if (++node->attempts < kStreamingSplitAttempts) {
+          growing_.push_back(std::move(*node));
+        } else {
+          node->tree->finish_leaf(node->node);
+        }
+        continue;
+      }
+
+      node->node->set_splitter(SplitterFn(best->feature, best->threshold));
+      auto* tree = node->tree;
+      node->left = children.size();
+      children.emplace_back(
+          tree, tree->make_child(node->node, SplitDirection::LEFT),
+          node->counts, node->depth + 1, SampledDataSet());
+      node->right = children.size();
+      children.emplace_back(
+          tree, tree->make_child(node->node, SplitDirection::RIGHT),
+          node->counts, node->depth + 1, SampledDataSet());
+      split.push_back(node);
+    }
+
+    // Samples are visited in increasing order, so the children's lists stay
+    // sorted.
+    const auto partitioned = stream(
+        split, [&children](PendingNode& node, FeatureView<T> features,
+                           ClassIndex, SampleIndex sample) {
+          const auto dir = node.node->split_direction(features);
+          auto& child =
+              children[dir == SplitDirection::LEFT ? node.left : node.right];
+          child.samples.push_back(sample);
+        });
+    if (!partitioned) return false;
+
+    for (auto& child : children) {
+      schedule(std::move(child));
+    }
+    return true;
+  }
+
+  // Trains the nodes in gathering_ in memory, in batches whose samples fit in
+  // the budget.
+  bool train_gathered() {
+    auto pending = std::move(gathering_);
+    gathering_.clear();
+
+    auto first = 0ul;
+    while (first < pending.size()) {
+      // Every node fits in the budget on its own.
+      auto last = first;
+      auto n_samples = 0ul;
+      while (last < pending.size() &&
+             n_samples + pending[last].samples.size() <= gather_samples_) {
+        n_samples += pending[last].samples.size();
+        ++last;
+      }
+
+      std::vector<PendingNode*> batch;
+      for (auto i = first; i < last; ++i) {
+        auto& node = pending[i];
+        node.data =
+            empty_data_set<T>(node.samples.size(), source_.n_features());
+        node.data_labels.values = labels_.values;
+        node.data_labels.classes.resize(node.samples.size());
+        node.data_counts.resize(node.samples.size());
+        node.n_gathered = 0;
+        batch.push_back(&node);
+      }
+
+      const auto gathered = stream(batch, [](PendingNode& node,
+                                             FeatureView<T> features,
+                                             ClassIndex label,
+                                             SampleIndex sample) {
+        const auto row = node.n_gathered++;
+        for (auto feature = 0ul; feature < features.size(); ++feature) {
+          node.data.features(row, feature) = features[feature];
+        }
+        node.data.labels[row] = node.data_labels.values[label];
+        node.data_labels.classes[row] = label;
+        node.data_counts[row] = (*node.counts)[sample];
+      });
+      if (!gathered) return false;
+
+      // Nodes of the same tree share its leaf count, so each tree's nodes are
+      // trained by a single task.
+      std::stable_sort(batch.begin(), batch.end(),
+                       [](const PendingNode* a, const PendingNode* b) {
+                         return std::less<Tree*>()(a->tree, b->tree);
+                       });
+      std::vector<std::future<void>> futures;
+      for (auto group = batch.begin(); group != batch.end();) {
+        const auto* tree = (*group)->tree;
+        const auto group_end =
+            std::find_if(group, batch.end(), [tree](const PendingNode* node) {
+              return node->tree != tree;
+            });
+        futures.emplace_back(thread_pool_->add([group, group_end]() {
+          for (auto it = group; it != group_end; ++it) {
+            auto& node = **it;
+            auto sample = sample_exactly(node.data);
+            const TrainingData<T> training{node.data, node.data_labels,
+                                           node.data_counts};
+            node.tree->train_recurse(node.node, training, sample.begin(),
+                                     sample.end(), node.depth);
+            node.data = DataSet<T>();
+            node.data_labels = EncodedLabels();
+            node.data_counts = SampleCounts();
+          }
+        }));
+        group = group_end;
+      }
+
+      for (auto& fut : futures) {
+        fut.wait();
+      }
+      first = last;
+    }
+    return true;
+  }
+
+  // Streams the data a chunk at a time, calling
+  // visit(node, features, label, sample) for every sample of every node, with
+  // the class of the sample's label.
+  // Nodes are spread over the thread pool, but each node sees its samples in
+  // increasing order from one task at a time.  Returns false if the source
+  // could not be read.
+  template <typename Visit>
+  bool stream(const std::vector<PendingNode*>& nodes, Visit visit) {
+    // Chunks past the last sample of every node need not be read.
+    std::size_t end = 0;
+    for (const auto* node : nodes) {
+      if (!node->samples.empty()) {
+        end = std::max<std::size_t>(end, node->samples.back() + 1);
+      }
+    }
+
+    const auto n_tasks = std::min(nodes.size(), thread_pool_->n_threads());
+    std::vector<std::size_t> cursors(nodes.size(), 0);
+    for (auto first = 0ul; first < end; first += chunk_samples_) {
+      const auto n = std::min(chunk_samples_, end - first);
+      if (!source_.read(first, n, &chunk_)) return false;
+      for (auto i = 0ul; i < n; ++i) {
+        chunk_classes_[i] = labels_.encode(chunk_.labels[i]);
+      }
+
+      const auto last = first + n;
+      std::vector<std::future<void>> futures;
+      for (auto task = 0ul; task < n_tasks; ++task) {
+        futures.emplace_back(thread_pool_->add([&, task, first, last]() {
+          for (auto i = task; i < nodes.size(); i += n_tasks) {
+            auto& node = *nodes[i];
+            auto& cursor = cursors[i];
+            for (; cursor < node.samples.size() && node.samples[cursor] < last;
+                 ++cursor) {
+              const auto sample = node.samples[cursor];
+              visit(node, chunk_.features.row(sample - first),
+                    chunk_classes_[sample - first], sample);
+            }
+          }
+        }));
+      }
+
+      for (auto& fut : futures) {
+        fut.wait();
+      }
+    }
+    return true;
+  }
+
+  const Source& source_;
+  double sample_fraction_;
+  qp::threading::Threadpool* thread_pool_;
+
+  // Samples read per chunk, and samples gathered per in memory batch.
+  std::size_t chunk_samples_;
+  std::size_t gather_samples_;
+  DataSet<T> chunk_;
+  std::vector<ClassIndex> chunk_classes_;
+
+  // The labels of the source, with no rows.
+  EncodedLabels labels_;
+
+  // The bootstrap sample counts of each tree.
+  std::vector<SampleCounts> counts_;
+
+  std::vector<PendingNode> growing_;
+  std::vector<PendingNode> gathering_;
+};
+
+}  // namespace rf
+}  // namespace qp
+
+#endif /* STREAMING_H */
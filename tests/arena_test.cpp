@@ -0,0 +1,76 @@
+#include <future>
+#include <set>
+#include <vector>
+
+#include "arena.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class ArenaTest : public ::testing::Test {};
+
+namespace {
+
+// Counts how many are alive, to check the arena destroys every node.
+struct Counted {
+  explicit Counted(int* alive, int value = 0) : alive(alive), value(value) {
+    ++*alive;
+  }
+  ~Counted() { --*alive; }
+
+  int* alive;
+  int value;
+};
+
+}  // namespace
+
+TEST_F(ArenaTest, MakeAndClear) {
+  int alive = 0;
+  {
+    qp::rf::NodeArena<Counted> arena;
+    std::vector<Counted*> nodes;
+    for (auto i = 0; i < 1000; ++i) nodes.push_back(arena.make(&alive, i));
+    EXPECT_EQ(arena.size(), 1000);
+    EXPECT_EQ(alive, 1000);
+    for (auto i = 0; i < 1000; ++i) EXPECT_EQ(nodes[i]->value, i);
+
+    arena.clear();
+    EXPECT_EQ(arena.size(), 0);
+    EXPECT_EQ(alive, 0);
+
+    arena.make(&alive);
+    // Moving an arena moves its nodes without copying them.
+    auto moved = std::move(arena);
+    EXPECT_EQ(moved.size(), 1);
+    EXPECT_EQ(arena.size(), 0);
+    EXPECT_EQ(alive, 1);
+  }
+  EXPECT_EQ(alive, 0);
+}
+
+TEST_F(ArenaTest, MakeFromThreads) {
+  int alive = 0;
+  qp::rf::NodeArena<Counted> arena;
+  qp::threading::Threadpool thread_pool(4);
+  std::vector<std::future<std::vector<Counted*>>> futures;
+  for (auto task = 0; task < 8; ++task) {
+    futures.push_back(thread_pool.add([&arena, &alive, task]() {
+      std::vector<Counted*> nodes;
+      for (auto i = 0; i < 500; ++i) {
+        nodes.push_back(arena.make(&alive, task * 500 + i));
+      }
+      return nodes;
+    }));
+  }
+
+  // Every node is made once, in its own place.
+  std::set<Counted*> nodes;
+  for (auto& future : futures) {
+    for (auto* node : future.get()) nodes.insert(node);
+  }
+  EXPECT_EQ(nodes.size(), 4000);
+  EXPECT_EQ(arena.size(), 4000);
+  std::set<int> values;
+  for (auto* node : nodes) values.insert(node->value);
+  EXPECT_EQ(values.size(), 4000);
+}
@@ -0,0 +1,199 @@
+#include <unistd.h>
+
+#include <cstdint>
+#include <fstream>
+#include <limits>
+
+#include "binary_dataset.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+
+// Removes the file at path when it goes out of scope.
+class TempFile {
+ public:
+  TempFile() {
+    char path[] = "/tmp/binary_dataset_test_XXXXXX";
+    close(mkstemp(path));
+    path_ = path;
+  }
+
+  ~TempFile() { unlink(path_.c_str()); }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+class BinaryDataSetTest : public ::testing::Test {};
+
+template <typename T>
+class TypedBinaryDataSetTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedBinaryDataSetTest, FeatureTypes);
+
+TYPED_TEST(TypedBinaryDataSetTest, RoundTrip) {
+  for (const auto layout :
+       {qp::rf::Layout::ROW_MAJOR, qp::rf::Layout::COLUMN_MAJOR}) {
+    auto data_set = qp::rf::empty_data_set<TypeParam>(3, 2, layout);
+    data_set.features(0, 1) = 5;
+    data_set.features(2, 0) = 200;
+    data_set.labels = {1, 2, 0.5};
+
+    TempFile file;
+    ASSERT_TRUE(qp::rf::write_binary_data_set(data_set, file.path()));
+
+    qp::rf::DataSet<TypeParam> loaded;
+    ASSERT_TRUE(qp::rf::read_binary_data_set(file.path(), &loaded));
+
+    EXPECT_TRUE(loaded.features.is_view());
+    EXPECT_EQ(loaded.features.layout(), layout);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(loaded.features.data()) %
+                  qp::rf::kFeatureAlignment,
+              0);
+    EXPECT_THAT(loaded.labels, ElementsAre(1, 2, 0.5));
+    EXPECT_THAT(loaded.features.row(0).to_vector(), ElementsAre(0, 5));
+    EXPECT_THAT(loaded.features.row(2).to_vector(), ElementsAre(200, 0));
+  }
+}
+
+TEST_F(BinaryDataSetTest, ChangesStayPrivate) {
+  auto data_set = qp::rf::empty_data_set(2, 2);
+  TempFile file;
+  ASSERT_TRUE(qp::rf::write_binary_data_set(data_set, file.path()));
+
+  {
+    qp::rf::DataSet<> loaded;
+    ASSERT_TRUE(qp::rf::read_binary_data_set(file.path(), &loaded));
+    loaded.features(1, 1) = 7;
+
+    // Copies own their values.
+    const auto copy = loaded.features;
+    EXPECT_FALSE(copy.is_view());
+    EXPECT_EQ(copy(1, 1), 7);
+  }
+
+  qp::rf::DataSet<> reloaded;
+  ASSERT_TRUE(qp::rf::read_binary_data_set(file.path(), &reloaded));
+  EXPECT_EQ(reloaded.features(1, 1), 0);
+}
+
+TEST_F(BinaryDataSetTest, RejectsOtherFiles) {
+  auto data_set = qp::rf::empty_data_set<float>(2, 2);
+  TempFile file;
+  ASSERT_TRUE(qp::rf::write_binary_data_set(data_set, file.path()));
+
+  // Wrong feature type.
+  qp::rf::DataSet<double> loaded;
+  EXPECT_FALSE(qp::rf::read_binary_data_set(file.path(), &loaded));
+
+  // Not a dataset at all.
+  std::ofstream(file.path()) << "1,2,3\n";
+  EXPECT_FALSE(qp::rf::read_binary_data_set(file.path(), &loaded));
+
+  EXPECT_FALSE(qp::rf::read_binary_data_set("/tmp/does/not/exist", &loaded));
+}
+
+TYPED_TEST(TypedBinaryDataSetTest, ReadChunks) {
+  for (const auto layout :
+       {qp::rf::Layout::ROW_MAJOR, qp::rf::Layout::COLUMN_MAJOR}) {
+    auto data_set = qp::rf::empty_data_set<TypeParam>(5, 2, layout);
+    for (auto i = 0ul; i < data_set.size(); ++i) {
+      data_set.features(i, 0) = 10 * i;
+      data_set.features(i, 1) = 10 * i + 1;
+      data_set.labels[i] = i;
+    }
+
+    TempFile file;
+    ASSERT_TRUE(qp::rf::write_binary_data_set(data_set, file.path()));
+
+    qp::rf::BinaryDataSource<TypeParam> source(file.path());
+    ASSERT_TRUE(static_cast<bool>(source));
+    EXPECT_EQ(source.size(), 5);
+    EXPECT_EQ(source.n_features(), 2);
+
+    auto chunk =
+        qp::rf::empty_data_set<TypeParam>(3, 2, qp::rf::Layout::ROW_MAJOR);
+    ASSERT_TRUE(source.read(3, 2, &chunk));
+    EXPECT_THAT(chunk.labels, ElementsAre(3, 4, 0));
+    EXPECT_THAT(chunk.features.row(0).to_vector(), ElementsAre(30, 31));
+    EXPECT_THAT(chunk.features.row(1).to_vector(), ElementsAre(40, 41));
+
+    // Reading past the end of the file fails.
+    EXPECT_FALSE(source.read(4, 2, &chunk));
+  }
+
+  qp::rf::BinaryDataSource<TypeParam> missing("/tmp/does/not/exist");
+  EXPECT_FALSE(static_cast<bool>(missing));
+}
+
+TEST_F(BinaryDataSetTest, CachedCsv) {
+  TempFile csv, cache;
+  std::ofstream(csv.path()) << "1,2,3\n0,4,5\n";
+  // Make the cache older than the csv so that it is rebuilt.
+  std::ofstream(cache.path()) << "stale";
+  const timespec times[2] = {{0, 0}, {0, 0}};
+  utimensat(AT_FDCWD, cache.path().c_str(), times, 0);
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DataSet<std::uint8_t> parsed;
+  ASSERT_TRUE(qp::rf::read_cached_csv_data_set(csv.path(), cache.path(),
+                                               &thread_pool, &parsed));
+  EXPECT_FALSE(parsed.features.is_view());
+  EXPECT_THAT(parsed.labels, ElementsAre(1, 0));
+
+  qp::rf::DataSet<std::uint8_t> cached;
+  ASSERT_TRUE(qp::rf::read_cached_csv_data_set(csv.path(), cache.path(),
+                                               &thread_pool, &cached));
+  EXPECT_TRUE(cached.features.is_view());
+  EXPECT_THAT(cached.labels, ElementsAre(1, 0));
+  EXPECT_THAT(cached.features.row(1).to_vector(), ElementsAre(4, 5));
+}
+
+TEST_F(BinaryDataSetTest, RejectsCorruptHeaders) {
+  TempFile csv, cache;
+  std::ofstream(csv.path()) << "1,2,3\n0,4,5\n";
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DataSet<> data_set;
+  ASSERT_TRUE(qp::rf::read_cached_csv_data_set(csv.path(), cache.path(),
+                                               &thread_pool, &data_set));
+
+  qp::rf::BinaryDataSetHeader header;
+  std::ifstream(cache.path(), std::ios::binary)
+      .read(reinterpret_cast<char*>(&header), sizeof(header));
+
+  const auto max = std::numeric_limits<std::uint64_t>::max();
+  auto unknown_layout = header, misaligned_features = header,
+       misaligned_labels = header, overflowing_features = header,
+       overflowing_labels = header, out_of_bounds = header;
+  unknown_layout.layout = static_cast<qp::rf::Layout>(7);
+  misaligned_features.features_offset += 1;
+  misaligned_labels.labels_offset += 4;
+  overflowing_features.n_features = max / 4;
+  overflowing_labels.n_samples = max / 4;
+  overflowing_labels.n_features = 0;
+  out_of_bounds.labels_offset = max - 7;
+  for (const auto& corrupt :
+       {unknown_layout, misaligned_features, misaligned_labels,
+        overflowing_features, overflowing_labels, out_of_bounds}) {
+    std::fstream(cache.path(), std::ios::binary | std::ios::in |
+                                   std::ios::out)
+        .write(reinterpret_cast<const char*>(&corrupt), sizeof(corrupt));
+
+    qp::rf::DataSet<> loaded;
+    EXPECT_FALSE(qp::rf::read_binary_data_set(cache.path(), &loaded));
+    EXPECT_FALSE(static_cast<bool>(
+        qp::rf::BinaryDataSource<double>(cache.path())));
+
+    // The cache is newer than the csv, but is reparsed, and rewritten.
+    ASSERT_TRUE(qp::rf::read_cached_csv_data_set(csv.path(), cache.path(),
+                                                 &thread_pool, &loaded));
+    EXPECT_FALSE(loaded.features.is_view());
+    EXPECT_THAT(loaded.labels, ElementsAre(1, 0));
+    EXPECT_THAT(loaded.features.row(1).to_vector(), ElementsAre(4, 5));
+    ASSERT_TRUE(qp::rf::read_binary_data_set(cache.path(), &loaded));
+  }
+}
@@ -0,0 +1,114 @@
+#include <cstdint>
+
+#include "binning.h"
+#include "dataset.h"
+#include "forest.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+
+class BinningTest : public ::testing::Test {};
+
+template <typename T>
+class TypedBinningTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedBinningTest, FeatureTypes);
+
+TYPED_TEST(TypedBinningTest, BinsEachValue) {
+  auto data_set = qp::rf::empty_data_set<TypeParam>(4, 2);
+  data_set.features(0, 0) = 30;
+  data_set.features(1, 0) = 10;
+  data_set.features(2, 0) = 30;
+  data_set.features(3, 0) = 20;
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::BinnedFeatures<TypeParam> binned(data_set, &thread_pool);
+
+  // Few enough values get a bin each, with boundaries halfway between them.
+  EXPECT_EQ(binned.n_bins(0), 3);
+  const auto* bins = binned.bins(0);
+  EXPECT_THAT(std::vector<qp::rf::Bin>(bins, bins + 4),
+              ElementsAre(2, 0, 2, 1));
+  EXPECT_EQ(binned.lower_bound(0, 1), 15);
+  EXPECT_EQ(binned.lower_bound(0, 2), 25);
+
+  // A constant feature has a single bin.
+  EXPECT_EQ(binned.n_bins(1), 1);
+}
+
+TEST_F(BinningTest, QuantileBins) {
+  auto data_set = qp::rf::empty_data_set<float>(1000, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = (i * 37) % 1000;
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::BinnedFeatures<float> binned(data_set, &thread_pool, 4);
+
+  // Each bin holds a quarter of the rows, and a value is below a bin's lower
+  // boundary exactly when its bin comes first.
+  ASSERT_EQ(binned.n_bins(0), 4);
+  std::vector<int> sizes(4);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    const auto bin = binned.bins(0)[i];
+    ++sizes[bin];
+    for (auto boundary = 1ul; boundary < 4; ++boundary) {
+      EXPECT_EQ(data_set.features(i, 0) < binned.lower_bound(0, boundary),
+                bin < boundary);
+    }
+  }
+  EXPECT_THAT(sizes, ElementsAre(250, 250, 250, 250));
+}
+
+TEST_F(BinningTest, BestThreshold) {
+  // Labels change once the feature reaches 60, apart from one noisy sample.
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(100, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.labels[i] = i >= 60;
+  }
+  data_set.labels[10] = 1;
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::BinnedFeatures<std::uint8_t> binned(data_set, &thread_pool);
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+  auto sample = qp::rf::sample_exactly(data_set);
+
+  qp::rf::BinnedUnivariateSplit<> split;
+  split.train(qp::rf::TrainingData<std::uint8_t>{data_set, labels, counts,
+                                                 nullptr, &binned},
+              sample.begin(), sample.end());
+  EXPECT_EQ(split.threshold(), 59.5);
+  // Only the noisy sample is misplaced: 60 samples of which one is impure.
+  EXPECT_NEAR(split.impurity(), 0.6 * (2 * (1 / 60.0) * (59 / 60.0)), 1e-12);
+  EXPECT_EQ(split.apply(data_set.features.row(59)),
+            qp::rf::SplitDirection::LEFT);
+  EXPECT_EQ(split.apply(data_set.features.row(60)),
+            qp::rf::SplitDirection::RIGHT);
+}
+
+TEST_F(BinningTest, TrainForest) {
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(200, 2);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.features(i, 1) = (i * 37) % 200;
+    data_set.labels[i] = (i < 100) + 2 * (data_set.features(i, 1) < 50);
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::BinnedFeatures<std::uint8_t> binned(data_set, &thread_pool);
+  qp::rf::DecisionForest<qp::rf::BinnedUnivariateSplit<>, std::uint8_t>
+      forest(5, -1, &thread_pool);
+  forest.train(data_set, binned);
+
+  auto correct = 0;
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    correct += forest.predict(data_set.features.row(i)) == data_set.labels[i];
+  }
+  EXPECT_GT(correct, 190);
+}
@@ -0,0 +1,173 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "codegen.h"
+#include "dataset.h"
+#include "forest.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+// A path in a directory of its own, where the source and library of a
+// compiled forest are removed when it goes out of scope.
+class TempPath {
+ public:
+  explicit TempPath(const std::string& name = "forest") {
+    char directory[] = "/tmp/codegen_test_XXXXXX";
+    directory_ = mkdtemp(directory);
+    path_ = directory_ + "/" + name;
+  }
+
+  ~TempPath() {
+    unlink((path_ + ".cpp").c_str());
+    unlink((path_ + ".so").c_str());
+    rmdir(directory_.c_str());
+  }
+
+  const std::string& path() const { return path_; }
+
+ private:
+  std::string directory_;
+  std::string path_;
+};
+
+class CodegenTest : public ::testing::Test {};
+
+template <typename T>
+class TypedCodegenTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedCodegenTest, FeatureTypes);
+
+TYPED_TEST(TypedCodegenTest, CompiledPredictsLikeForest) {
+  // A grid of a few values for each feature, with labels it does not decide,
+  // so that thresholds fall between many equal values and trees grow until
+  // their samples are identical.
+  auto data_set = qp::rf::empty_data_set<TypeParam>(2048, 3);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    for (auto feature = 0ul; feature < data_set.n_features(); ++feature) {
+      data_set.features(i, feature) = (i >> (3 * feature)) % 8 * 30;
+    }
+    data_set.labels[i] = (i * 5 + i / 7) % 3 + 0.5;
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, TypeParam> forest(
+      10, -1, &thread_pool);
+  forest.train(data_set);
+
+  const TempPath path;
+  qp::rf::CompiledForest<TypeParam> compiled;
+  ASSERT_TRUE(compiled.compile(forest, path.path(), {"c++", "-O1"}));
+  ASSERT_TRUE(compiled.loaded());
+
+  // The dataset is column major, so the features of each sample are copied
+  // before they are passed on, and those of a row major copy are not.
+  const auto rows = data_set.features.with_layout(qp::rf::Layout::ROW_MAJOR);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    const auto features = data_set.features.row(i);
+    EXPECT_EQ(compiled.predict(features), forest.predict(features));
+    EXPECT_EQ(compiled.predict(rows.row(i)), forest.predict(features));
+  }
+}
+
+TEST_F(CodegenTest, DeepTreesSpillIntoFunctions) {
+  // Each feature doubles the last, so that a random threshold almost always
+  // splits off only the largest, and with alternating labels every tree is a
+  // chain as deep as it has samples.
+  auto data_set = qp::rf::empty_data_set(300, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = std::ldexp(1.0, i);
+    data_set.labels[i] = i % 2;
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit> forest(
+      3, -1, &thread_pool);
+  forest.train(data_set);
+  for (const auto& tree : forest.trees()) {
+    EXPECT_GT(tree.depth(), qp::rf::detail::kMaxNestedDepth);
+  }
+
+  std::ostringstream source;
+  qp::rf::write_forest_source(forest, source);
+  EXPECT_NE(source.str().find("tree_0_1(f)"), std::string::npos);
+
+  const TempPath path;
+  qp::rf::CompiledForest<> compiled;
+  ASSERT_TRUE(compiled.compile(forest, path.path(), {"c++", "-O1"}));
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    const auto features = data_set.features.row(i);
+    EXPECT_EQ(compiled.predict(features), forest.predict(features));
+  }
+}
+
+TEST_F(CodegenTest, WritesSource) {
+  auto data_set = qp::rf::empty_data_set(100, 2);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.features(i, 1) = i % 10;
+    data_set.labels[i] = i < 50;
+  }
+
+  qp::threading::Threadpool thread_pool(1);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit> forest(
+      3, -1, &thread_pool);
+  forest.train(data_set);
+
+  std::ostringstream source;
+  qp::rf::write_forest_source(forest, source);
+  const auto text = source.str();
+  EXPECT_NE(text.find("extern \"C\" double qp_rf_predict(const double* f)"),
+            std::string::npos);
+  for (const auto* tree : {"tree_0_0(f)", "tree_1_0(f)", "tree_2_0(f)"}) {
+    EXPECT_NE(text.find(tree), std::string::npos);
+  }
+  EXPECT_EQ(text.find("tree_3_0"), std::string::npos);
+  // Labels are exact hexadecimal literals.
+  EXPECT_NE(text.find("0x1p+0"), std::string::npos);
+}
+
+TEST_F(CodegenTest, CompileFailure) {
+  auto data_set = qp::rf::empty_data_set(10, 1);
+  qp::threading::Threadpool thread_pool(1);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit> forest(
+      1, -1, &thread_pool);
+  forest.train(data_set);
+
+  const TempPath path;
+  qp::rf::CompiledForest<> compiled;
+  EXPECT_FALSE(compiled.compile(forest, path.path(), {"false"}));
+  EXPECT_FALSE(compiled.loaded());
+  EXPECT_FALSE(compiled.load("/tmp/does/not/exist.so"));
+  EXPECT_FALSE(compiled.compile(forest, path.path(), {"/does/not/exist"}));
+}
+
+TEST_F(CodegenTest, PathsAreNotInterpreted) {
+  auto data_set = qp::rf::empty_data_set(10, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.labels[i] = i < 5;
+  }
+  qp::threading::Threadpool thread_pool(1);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit> forest(
+      1, -1, &thread_pool);
+  forest.train(data_set);
+
+  // Quotes and separators in the path reach the compiler as they are,
+  // rather than ending its command and starting another.
+  const TempPath path("it's; touch injected '");
+  qp::rf::CompiledForest<> compiled;
+  ASSERT_TRUE(compiled.compile(forest, path.path(), {"c++"}));
+  EXPECT_EQ(access("injected", F_OK), -1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    const auto features = data_set.features.row(i);
+    EXPECT_EQ(compiled.predict(features), forest.predict(features));
+  }
+}
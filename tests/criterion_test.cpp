@@ -1,3 +1,7 @@
+#include <cmath>
+#include <limits>
+#include <vector>
+
 #include "criterion.h"
 #include "gtest/gtest.h"
 
@@ -6,7 +10,8 @@ class CriterionTest : public ::testing::Test {};
 using qp::rf::LabelHistogram;
 
 TEST_F(CriterionTest, ZeroImpurity) {
-  LabelHistogram label_histogram{{1, 10}};
+  LabelHistogram label_histogram(2);
+  label_histogram[1] = 10;
   auto elements_impurity = qp::rf::gini_impurity(label_histogram);
 
   EXPECT_EQ(elements_impurity.first, 10);
@@ -14,7 +19,10 @@ TEST_F(CriterionTest, ZeroImpurity) {
 }
 
 TEST_F(CriterionTest, NonZeroImpurity) {
-  LabelHistogram label_histogram{{1, 3}, {4, 7}, {5, 2}};
+  LabelHistogram label_histogram(3);
+  label_histogram[0] = 3;
+  label_histogram[1] = 7;
+  label_histogram[2] = 2;
   auto elements_impurity = qp::rf::gini_impurity(label_histogram);
 
   const double expected_size = 12;
@@ -26,3 +34,83 @@ TEST_F(CriterionTest, NonZeroImpurity) {
   EXPECT_EQ(expected_size, elements_impurity.first);
   EXPECT_DOUBLE_EQ(expected_impurity, elements_impurity.second);
 }
+
+TEST_F(CriterionTest, SplitImpurity) {
+  LabelHistogram left(2), right(2);
+  left[0] = 3;
+  right[0] = 1;
+  right[1] = 1;
+
+  // The pure side counts for nothing, and the even side for half its weight.
+  EXPECT_DOUBLE_EQ(qp::rf::split_impurity(left, right), (2 / 5.0) * 0.5);
+}
+
+TEST_F(CriterionTest, FixedHistogram) {
+  LabelHistogram dynamic(3);
+  qp::rf::FixedLabelHistogram<4> fixed(3);
+  dynamic[0] = fixed[0] = 3;
+  dynamic[2] = fixed[2] = 5;
+
+  // The unused fourth class does not change anything.
+  EXPECT_EQ(qp::rf::gini_impurity(fixed), qp::rf::gini_impurity(dynamic));
+  EXPECT_EQ(qp::rf::mode_class(fixed), 2);
+}
+
+TEST_F(CriterionTest, Criteria) {
+  LabelHistogram histogram(3);
+  histogram[0] = 3;
+  histogram[2] = 1;
+
+  EXPECT_DOUBLE_EQ(qp::rf::impurity<qp::rf::Gini>(histogram),
+                   qp::rf::gini_impurity(histogram).second);
+  EXPECT_DOUBLE_EQ(qp::rf::impurity<qp::rf::Entropy>(histogram),
+                   -0.75 * std::log(0.75) - 0.25 * std::log(0.25));
+  EXPECT_DOUBLE_EQ(qp::rf::impurity<qp::rf::Misclassification>(histogram),
+                   0.25);
+
+  // A pure or empty histogram has no impurity under any criterion.
+  LabelHistogram pure(3);
+  pure[1] = 4;
+  EXPECT_EQ(qp::rf::impurity<qp::rf::Entropy>(pure), 0);
+  EXPECT_EQ(qp::rf::impurity<qp::rf::Misclassification>(pure), 0);
+  EXPECT_EQ(qp::rf::impurity<qp::rf::Entropy>(LabelHistogram(3)), 0);
+}
+
+template <typename CriterionT>
+void expect_split_impurities_match() {
+  // More candidates than fit in a vector, with one left over, and some which
+  // send every sample one way.
+  const std::size_t n_classes = 3, n_candidates = 19;
+  std::vector<double> left(n_classes * n_candidates),
+      right(n_classes * n_candidates);
+  for (auto c = 0ul; c < n_classes; ++c) {
+    for (auto i = 0ul; i < n_candidates; ++i) {
+      left[c * n_candidates + i] = i % 5 == 0 ? 0 : (i * 7 + c * 3) % 11;
+      right[c * n_candidates + i] = (i * 13 + c * 5) % 17 + 1000 * c;
+    }
+  }
+
+  std::vector<double> impurities(n_candidates);
+  qp::rf::split_impurities<CriterionT>(left.data(), right.data(), n_classes,
+                                       n_candidates, impurities.data());
+  for (auto i = 0ul; i < n_candidates; ++i) {
+    LabelHistogram went_left(n_classes), went_right(n_classes);
+    for (auto c = 0ul; c < n_classes; ++c) {
+      went_left[c] = left[c * n_candidates + i];
+      went_right[c] = right[c * n_candidates + i];
+    }
+    if (went_left.total() == 0) {
+      EXPECT_EQ(impurities[i], std::numeric_limits<double>::infinity());
+    } else {
+      EXPECT_NEAR(impurities[i],
+                  qp::rf::split_impurity<CriterionT>(went_left, went_right),
+                  1e-12);
+    }
+  }
+}
+
+TEST_F(CriterionTest, SplitImpurities) {
+  expect_split_impurities_match<qp::rf::Gini>();
+  expect_split_impurities_match<qp::rf::Entropy>();
+  expect_split_impurities_match<qp::rf::Misclassification>();
+}
@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <sstream>
 
 #include "csv.h"
@@ -19,11 +20,11 @@ TEST_F(CsvTest, ReadAll) {
 
   EXPECT_EQ(dataset.size(), 2);
 
-  EXPECT_EQ(dataset.front().label, 1);
-  EXPECT_THAT(dataset.front().features, ElementsAre(2, 3, 4));
+  EXPECT_EQ(dataset.labels[0], 1);
+  EXPECT_THAT(dataset.features.row(0).to_vector(), ElementsAre(2, 3, 4));
 
-  EXPECT_EQ(dataset[1].label, 2);
-  EXPECT_THAT(dataset[1].features, ElementsAre(7, 8, 6));
+  EXPECT_EQ(dataset.labels[1], 2);
+  EXPECT_THAT(dataset.features.row(1).to_vector(), ElementsAre(7, 8, 6));
 }
 
 TEST_F(CsvTest, ReadSome) {
@@ -39,9 +40,174 @@ TEST_F(CsvTest, ReadSome) {
 
   EXPECT_EQ(dataset.size(), 2);
 
-  EXPECT_EQ(dataset.front().label, 1);
-  EXPECT_THAT(dataset.front().features, ElementsAre(2, 0.3, 4.7));
+  EXPECT_EQ(dataset.labels[0], 1);
+  EXPECT_THAT(dataset.features.row(0).to_vector(), ElementsAre(2, 0.3, 4.7));
 
-  EXPECT_EQ(dataset[1].label, 2);
-  EXPECT_THAT(dataset[1].features, ElementsAre(7, 8, 6));
+  EXPECT_EQ(dataset.labels[1], 2);
+  EXPECT_THAT(dataset.features.row(1).to_vector(), ElementsAre(7, 8, 6));
+}
+
+template <typename T>
+class TypedCsvTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedCsvTest, FeatureTypes);
+
+TYPED_TEST(TypedCsvTest, ReadAsType) {
+  std::string csv_dataset =
+      "1, 0, 128, 255\n"
+      "2, 7, 8, 6\n";
+
+  std::stringstream stream(csv_dataset);
+
+  const auto dataset = qp::rf::read_csv_data_set<TypeParam>(
+      stream, /* n_samples=*/2, /*n_features=*/3);
+
+  EXPECT_EQ(dataset.labels[0], 1);
+  EXPECT_THAT(dataset.features.row(0).to_vector(), ElementsAre(0, 128, 255));
+
+  EXPECT_EQ(dataset.labels[1], 2);
+  EXPECT_THAT(dataset.features.row(1).to_vector(), ElementsAre(7, 8, 6));
+}
+
+TEST_F(CsvTest, DetectShape) {
+  std::string csv_dataset =
+      "1,2,0.3,4.7\n"
+      "2,7,8,6\n"
+      "1,0.7,8,6";
+
+  const auto shape = qp::rf::csv_shape(
+      csv_dataset.data(), csv_dataset.data() + csv_dataset.size());
+  EXPECT_EQ(shape.n_rows, 3);
+  EXPECT_EQ(shape.n_features, 3);
+
+  const auto dataset = qp::rf::read_csv_data_set(
+      csv_dataset.data(), csv_dataset.data() + csv_dataset.size());
+
+  EXPECT_EQ(dataset.size(), 3);
+  EXPECT_THAT(dataset.labels, ElementsAre(1, 2, 1));
+  EXPECT_THAT(dataset.features.row(0).to_vector(), ElementsAre(2, 0.3, 4.7));
+  EXPECT_THAT(dataset.features.row(2).to_vector(), ElementsAre(0.7, 8, 6));
+
+  // A null malformed is not taken for a thread pool.
+  EXPECT_EQ(qp::rf::read_csv_data_set<double>(
+                csv_dataset.data(), csv_dataset.data() + csv_dataset.size(),
+                nullptr)
+                .size(),
+            3);
+}
+
+TEST_F(CsvTest, LeadingBlankLine) {
+  std::string csv_dataset = "\n1,2,3\n0,4,5\n";
+
+  const auto shape = qp::rf::csv_shape(
+      csv_dataset.data(), csv_dataset.data() + csv_dataset.size());
+  EXPECT_EQ(shape.n_rows, 3);
+  EXPECT_EQ(shape.n_features, 2);
+
+  std::vector<qp::rf::MalformedRow> malformed;
+  const auto dataset = qp::rf::read_csv_data_set(
+      csv_dataset.data(), csv_dataset.data() + csv_dataset.size(), &malformed);
+
+  EXPECT_TRUE(malformed.empty());
+  EXPECT_EQ(dataset.size(), 2);
+  EXPECT_EQ(dataset.n_features(), 2);
+  EXPECT_THAT(dataset.labels, ElementsAre(1, 0));
+  EXPECT_THAT(dataset.features.row(1).to_vector(), ElementsAre(4, 5));
+
+  qp::threading::Threadpool thread_pool(2);
+  const auto parallel = qp::rf::read_csv_data_set_parallel(
+      csv_dataset.data(), csv_dataset.data() + csv_dataset.size(),
+      &thread_pool, &malformed, qp::rf::Layout::COLUMN_MAJOR, 1);
+
+  EXPECT_TRUE(malformed.empty());
+  EXPECT_EQ(parallel.n_features(), 2);
+  EXPECT_THAT(parallel.labels, ElementsAre(1, 0));
+  EXPECT_THAT(parallel.features.row(1).to_vector(), ElementsAre(4, 5));
+}
+
+TEST_F(CsvTest, SkipMalformed) {
+  std::string csv_dataset =
+      "label,a,b\n"
+      "1, 2, 3\r\n"
+      "\n"
+      "2, 7\n"
+      "3, 4, x\n"
+      "4, 5, 6, 7\n"
+      "5, 1e2, -6\n";
+
+  std::vector<qp::rf::MalformedRow> malformed;
+  const auto dataset = qp::rf::read_csv_data_set(
+      csv_dataset.data(), csv_dataset.data() + csv_dataset.size(), &malformed);
+
+  EXPECT_EQ(dataset.size(), 2);
+  EXPECT_THAT(dataset.labels, ElementsAre(1, 5));
+  EXPECT_THAT(dataset.features.row(0).to_vector(), ElementsAre(2, 3));
+  EXPECT_THAT(dataset.features.row(1).to_vector(), ElementsAre(100, -6));
+
+  ASSERT_EQ(malformed.size(), 4);
+  EXPECT_EQ(malformed[0].line, 1);
+  EXPECT_EQ(malformed[1].line, 4);
+  EXPECT_EQ(malformed[2].line, 5);
+  EXPECT_EQ(malformed[3].line, 6);
+}
+
+TEST_F(CsvTest, ReadMappedFile) {
+  char path[] = "/tmp/csv_test_XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  const std::string csv_dataset = "1,2,3\n0,4,5\n";
+  ASSERT_EQ(write(fd, csv_dataset.data(), csv_dataset.size()),
+            csv_dataset.size());
+  close(fd);
+
+  {
+    qp::io::MappedFile file(path);
+    ASSERT_TRUE(static_cast<bool>(file));
+
+    const auto dataset = qp::rf::read_csv_data_set<std::uint8_t>(file);
+    EXPECT_THAT(dataset.labels, ElementsAre(1, 0));
+    EXPECT_THAT(dataset.features.row(1).to_vector(), ElementsAre(4, 5));
+  }
+
+  unlink(path);
+  EXPECT_FALSE(static_cast<bool>(qp::io::MappedFile(path)));
+}
+
+TEST_F(CsvTest, ReadParallel) {
+  std::string csv_dataset;
+  for (int i = 0; i < 100; ++i) {
+    csv_dataset += std::to_string(i % 3) + ", " + std::to_string(i) + ", " +
+                   std::to_string(2 * i) + "\n";
+    // Sprinkle in some bad lines to make sure the gaps are closed.
+    if (i % 17 == 0) csv_dataset += "x, 1, 2\n";
+    if (i % 23 == 0) csv_dataset += "\n";
+  }
+
+  qp::threading::Threadpool thread_pool(4);
+  std::vector<qp::rf::MalformedRow> sequential_errors, parallel_errors;
+  const auto* first = csv_dataset.data();
+  const auto* last = first + csv_dataset.size();
+  const auto sequential =
+      qp::rf::read_csv_data_set(first, last, &sequential_errors);
+
+  // Small chunks so that lines are spread over many tasks.
+  for (const auto chunk_bytes : {1ul, 16ul, 100ul, 1ul << 20}) {
+    parallel_errors.clear();
+    const auto parallel = qp::rf::read_csv_data_set_parallel(
+        first, last, &thread_pool, &parallel_errors,
+        qp::rf::Layout::COLUMN_MAJOR, chunk_bytes);
+
+    ASSERT_EQ(parallel.size(), 100);
+    EXPECT_EQ(parallel.labels, sequential.labels);
+    for (auto i = 0ul; i < parallel.size(); ++i) {
+      EXPECT_EQ(parallel.features.row(i).to_vector(),
+                sequential.features.row(i).to_vector());
+    }
+
+    ASSERT_EQ(parallel_errors.size(), sequential_errors.size());
+    for (auto i = 0ul; i < parallel_errors.size(); ++i) {
+      EXPECT_EQ(parallel_errors[i].line, sequential_errors[i].line);
+    }
+  }
 }
@@ -1,27 +1,37 @@
+#include <algorithm>
+#include <numeric>
 #include <sstream>
 
 #include "csv.h"
 #include "dataset.h"
+#include "threadpool.h"
 #include "gtest/gmock.h"
 #include "gtest/gtest.h"
 
 using ::testing::DoubleEq;
+using ::testing::DoubleNear;
 using ::testing::ElementsAre;
 class DataSetTest : public ::testing::Test {};
 
 TEST_F(DataSetTest, CompareOnFeature) {
-  auto dataset = qp::rf::empty_data_set(3, 3);
-  dataset.front().features = {1, 2, 3};
-  dataset[1].features = {5, 7, 9};
-  dataset[2].features = {9, 0, 11};
+  std::string csv_dataset =
+      "0, 1, 2, 3\n"
+      "0, 5, 7, 9\n"
+      "0, 9, 0, 11\n";
 
-  const auto t1 = std::max_element(dataset.begin(), dataset.end(),
-                                   qp::rf::CompareOnFeature<>(1));
-  EXPECT_THAT(t1->features, ElementsAre(5, 7, 9));
+  std::stringstream stream(csv_dataset);
+  const auto dataset = qp::rf::read_csv_data_set(stream, 3, 3);
+  auto sampled = qp::rf::sample_exactly(dataset);
 
-  const auto t2 = std::max_element(dataset.begin(), dataset.end(),
-                                   qp::rf::CompareOnFeature<>(0));
-  EXPECT_THAT(t2->features, ElementsAre(9, 0, 11));
+  const auto t1 =
+      std::max_element(sampled.begin(), sampled.end(),
+                       qp::rf::CompareOnFeature<double>(dataset, 1));
+  EXPECT_THAT(dataset.features.row(*t1).to_vector(), ElementsAre(5, 7, 9));
+
+  const auto t2 =
+      std::max_element(sampled.begin(), sampled.end(),
+                       qp::rf::CompareOnFeature<double>(dataset, 0));
+  EXPECT_THAT(dataset.features.row(*t2).to_vector(), ElementsAre(9, 0, 11));
 }
 
 TEST_F(DataSetTest, ModeLabel) {
@@ -33,29 +43,127 @@ TEST_F(DataSetTest, ModeLabel) {
   std::stringstream stream(csv_dataset);
   const auto dataset = qp::rf::read_csv_data_set(stream, 3, 2);
   auto sampled = qp::rf::sample_exactly(dataset);
+  const auto labels = qp::rf::encode_labels(dataset.labels);
+
+  const auto mode =
+      qp::rf::mode_class(labels, sampled.begin(), sampled.end());
+  EXPECT_EQ(labels.values[mode], 1);
 
-  const auto mode = qp::rf::mode_label(sampled.begin(), sampled.end());
-  EXPECT_EQ(mode, 1);
+  // Counting the second sample three times makes its label the most common.
+  const qp::rf::SampleCounts counts = {1, 3, 1};
+  EXPECT_EQ(qp::rf::mode_class(labels, counts, sampled.begin(), sampled.end()),
+            1);
+}
+
+TEST_F(DataSetTest, EncodeLabels) {
+  const auto labels = qp::rf::encode_labels({5, 2, 5, 7.5});
+
+  // Classes are numbered in increasing order of their labels.
+  EXPECT_EQ(labels.n_classes(), 3);
+  EXPECT_THAT(labels.values, ElementsAre(2, 5, 7.5));
+  EXPECT_THAT(labels.classes, ElementsAre(1, 0, 1, 2));
+  EXPECT_EQ(labels.encode(7.5), 2);
+}
+
+TEST_F(DataSetTest, LabelHistogram) {
+  // Both few classes, counted in place, and many, counted on the heap.
+  for (const auto n_classes : {3ul, 100ul}) {
+    qp::rf::LabelHistogram histogram(n_classes);
+    EXPECT_EQ(histogram.size(), n_classes);
+    EXPECT_EQ(histogram.total(), 0);
+
+    histogram[2] += 4;
+    ++histogram[0];
+    EXPECT_EQ(histogram.total(), 5);
+    EXPECT_EQ(qp::rf::mode_class(histogram), 2);
+
+    const auto copy = histogram;
+    histogram.clear();
+    EXPECT_EQ(histogram.total(), 0);
+    EXPECT_EQ(copy[2], 4);
+  }
 }
 
 TEST_F(DataSetTest, SingleLabel) {
   auto dataset = qp::rf::empty_data_set(3, 3);
-  dataset[0].label = 1;
-  dataset[1].label = 5;
-  dataset[2].label = 9;
+  dataset.labels = {1, 5, 9};
 
   auto sampled = qp::rf::sample_exactly(dataset);
 
-  const auto t1 = qp::rf::single_label(sampled.begin(), sampled.end());
+  const auto t1 =
+      qp::rf::single_label(dataset, sampled.begin(), sampled.end());
   EXPECT_FALSE(t1);
 
-  dataset[1].label = 1;
-  dataset[2].label = 1;
+  dataset.labels[1] = 1;
+  dataset.labels[2] = 1;
 
-  const auto t2 = qp::rf::single_label(sampled.begin(), sampled.end());
+  const auto t2 =
+      qp::rf::single_label(dataset, sampled.begin(), sampled.end());
   EXPECT_TRUE(t2);
 }
 
+TEST_F(DataSetTest, FeatureRange) {
+  auto dataset = qp::rf::empty_data_set<float>(4, 2);
+  dataset.features(0, 1) = 3;
+  dataset.features(1, 1) = -2;
+  dataset.features(2, 1) = 7;
+  dataset.features(3, 1) = 1;
+
+  // Only the sampled rows count.
+  qp::rf::SampledDataSet sampled = {3, 1, 1};
+  const auto range =
+      qp::rf::feature_range(dataset, sampled.begin(), sampled.end(), 1);
+  EXPECT_EQ(range.first, -2);
+  EXPECT_EQ(range.second, 1);
+}
+
+TEST_F(DataSetTest, SampleExactly) {
+  const auto dataset = qp::rf::empty_data_set(3, 1);
+  EXPECT_THAT(qp::rf::sample_exactly(dataset), ElementsAre(0, 1, 2));
+}
+
+TEST_F(DataSetTest, SampleWithReplacement) {
+  const auto dataset = qp::rf::empty_data_set(50, 1);
+  qp::rf::SampleCounts counts;
+  const auto sampled = qp::rf::sample_with_replacement(dataset, 100, &counts);
+
+  // Every drawn row is listed once, in order, and the counts add up to the
+  // number of draws.
+  ASSERT_EQ(counts.size(), 50);
+  EXPECT_TRUE(std::is_sorted(sampled.begin(), sampled.end()));
+  EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), 0), 100);
+  for (auto row = 0ul; row < counts.size(); ++row) {
+    EXPECT_EQ(counts[row] > 0,
+              std::binary_search(sampled.begin(), sampled.end(), row));
+  }
+}
+
+TEST_F(DataSetTest, SampleWithoutReplacement) {
+  const auto dataset = qp::rf::empty_data_set(50, 1);
+  qp::rf::SampleCounts counts;
+  const auto sampled = qp::rf::sample_without_replacement(dataset, 20, &counts);
+
+  // Exactly 20 distinct rows, each drawn once.
+  ASSERT_EQ(sampled.size(), 20);
+  EXPECT_EQ(std::adjacent_find(sampled.begin(), sampled.end(),
+                               std::greater_equal<>()),
+            sampled.end());
+  EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), 0), 20);
+  for (const auto row : sampled) {
+    EXPECT_EQ(counts[row], 1);
+  }
+}
+
+TEST_F(DataSetTest, SampleForTree) {
+  qp::rf::SampleCounts counts;
+  EXPECT_EQ(qp::rf::sample_for_tree(100, 0.25, &counts).size(), 25);
+  EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), 0), 25);
+
+  // A full fraction is a bootstrap sample.
+  qp::rf::sample_for_tree(100, 1, &counts);
+  EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), 0), 100);
+}
+
 TEST_F(DataSetTest, ZeroCenter) {
   std::string csv_dataset =
       "1, 2, 3\n"
@@ -71,10 +179,64 @@ TEST_F(DataSetTest, ZeroCenter) {
 
   EXPECT_THAT(means, ElementsAre(DoubleEq(5.666666), DoubleEq(6.33333)));
 
-  EXPECT_THAT(dataset[0].features,
+  EXPECT_THAT(dataset.features.row(0).to_vector(),
               ElementsAre(DoubleEq(-3.66667), DoubleEq(-3.33333)));
-  EXPECT_THAT(dataset[1].features,
+  EXPECT_THAT(dataset.features.row(1).to_vector(),
               ElementsAre(DoubleEq(1.33333), DoubleEq(2.66667)));
-  EXPECT_THAT(dataset[2].features,
+  EXPECT_THAT(dataset.features.row(2).to_vector(),
               ElementsAre(DoubleEq(2.33333), DoubleEq(0.66667)));
 }
+
+TEST_F(DataSetTest, FeatureStats) {
+  for (const auto layout :
+       {qp::rf::Layout::COLUMN_MAJOR, qp::rf::Layout::ROW_MAJOR}) {
+    auto dataset = qp::rf::empty_data_set<float>(3000, 3, layout);
+    for (auto i = 0ul; i < dataset.size(); ++i) {
+      dataset.features(i, 0) = 1e6 + i % 10;
+      dataset.features(i, 1) = -2;
+      dataset.features(i, 2) = i;
+    }
+
+    // Chunks found in parallel merge into the statistics of the whole set.
+    const auto n = static_cast<double>(dataset.size());
+    qp::threading::Threadpool thread_pool(3);
+    for (auto* pool : {&thread_pool, static_cast<decltype(&thread_pool)>(
+                                         nullptr)}) {
+      const auto stats = qp::rf::feature_stats(dataset, pool);
+      EXPECT_EQ(stats.n_samples, 3000);
+      EXPECT_THAT(stats.means, ElementsAre(DoubleNear(1e6 + 4.5, 1e-6),
+                                           DoubleEq(-2), DoubleEq(1499.5)));
+      EXPECT_THAT(stats.stddevs(),
+                  ElementsAre(DoubleNear(std::sqrt(8.25), 1e-9), DoubleEq(0),
+                              DoubleNear(std::sqrt((n * n - 1) / 12), 1e-9)));
+    }
+  }
+}
+
+TEST_F(DataSetTest, Normalize) {
+  auto training = qp::rf::empty_data_set<double>(500, 2);
+  auto testing = qp::rf::empty_data_set<double>(2, 2);
+  for (auto i = 0ul; i < training.size(); ++i) {
+    training.features(i, 0) = (i * 37) % 101;
+    training.features(i, 1) = 5;
+  }
+  testing.features(1, 0) = 80;
+
+  qp::threading::Threadpool thread_pool(2);
+  const auto stats = qp::rf::normalize(training, &thread_pool);
+  const auto normalized = qp::rf::feature_stats(training);
+  EXPECT_NEAR(normalized.means[0], 0, 1e-12);
+  EXPECT_NEAR(normalized.stddev(0), 1, 1e-12);
+  // Constant features are centered but not scaled.
+  EXPECT_THAT(training.features.column(1).to_vector(),
+              ::testing::Each(DoubleEq(0)));
+
+  // Other data is normalized by the training statistics, whether as a
+  // dataset or a single sample.
+  auto sample = testing.features.row(1).to_vector();
+  qp::rf::normalize(testing, stats);
+  qp::rf::normalize(sample, stats);
+  EXPECT_DOUBLE_EQ(testing.features(1, 0),
+                   (80 - stats.means[0]) / stats.stddev(0));
+  EXPECT_EQ(testing.features.row(1).to_vector(), sample);
+}
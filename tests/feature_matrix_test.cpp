@@ -0,0 +1,114 @@
+#include <cstdint>
+
+#include "feature_matrix.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+using qp::rf::Layout;
+class FeatureMatrixTest : public ::testing::Test {};
+
+using FeatureMatrix = qp::rf::FeatureMatrix<>;
+
+// Fills the matrix so that m(i, j) = 10 * i + j.
+void fill(FeatureMatrix& m) {
+  for (auto i = 0ul; i < m.n_samples(); ++i) {
+    for (auto j = 0ul; j < m.n_features(); ++j) {
+      m(i, j) = 10 * i + j;
+    }
+  }
+}
+
+TEST_F(FeatureMatrixTest, Aligned) {
+  FeatureMatrix m(3, 5);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(m.data()) %
+                qp::rf::kFeatureAlignment,
+            0);
+}
+
+TEST_F(FeatureMatrixTest, ColumnMajor) {
+  FeatureMatrix m(2, 3, Layout::COLUMN_MAJOR);
+  fill(m);
+
+  EXPECT_THAT(m.row(1).to_vector(), ElementsAre(10, 11, 12));
+  EXPECT_THAT(m.column(2).to_vector(), ElementsAre(2, 12));
+  EXPECT_EQ(m.column(2).stride(), 1);
+  EXPECT_THAT(std::vector<double>(m.data(), m.data() + 6),
+              ElementsAre(0, 10, 1, 11, 2, 12));
+}
+
+TEST_F(FeatureMatrixTest, RowMajor) {
+  FeatureMatrix m(2, 3, Layout::ROW_MAJOR);
+  fill(m);
+
+  EXPECT_THAT(m.row(1).to_vector(), ElementsAre(10, 11, 12));
+  EXPECT_EQ(m.row(1).stride(), 1);
+  EXPECT_THAT(m.column(2).to_vector(), ElementsAre(2, 12));
+  EXPECT_THAT(std::vector<double>(m.data(), m.data() + 6),
+              ElementsAre(0, 1, 2, 10, 11, 12));
+}
+
+TEST_F(FeatureMatrixTest, WithLayout) {
+  FeatureMatrix m(2, 3, Layout::COLUMN_MAJOR);
+  fill(m);
+
+  const auto row_major = m.with_layout(Layout::ROW_MAJOR);
+  EXPECT_EQ(row_major.layout(), Layout::ROW_MAJOR);
+  EXPECT_THAT(row_major.row(0).to_vector(), ElementsAre(0, 1, 2));
+  EXPECT_THAT(row_major.row(1).to_vector(), ElementsAre(10, 11, 12));
+}
+
+TEST_F(FeatureMatrixTest, AppendFeatures) {
+  for (const auto layout : {Layout::ROW_MAJOR, Layout::COLUMN_MAJOR}) {
+    FeatureMatrix m(2, 2, layout);
+    fill(m);
+    m.append_features(1);
+    m(1, 2) = 7;
+
+    EXPECT_EQ(m.n_features(), 3);
+    EXPECT_THAT(m.row(0).to_vector(), ElementsAre(0, 1, 0));
+    EXPECT_THAT(m.row(1).to_vector(), ElementsAre(10, 11, 7));
+  }
+}
+
+template <typename T>
+class TypedFeatureMatrixTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedFeatureMatrixTest, FeatureTypes);
+
+TYPED_TEST(TypedFeatureMatrixTest, StoresNarrowValues) {
+  qp::rf::FeatureMatrix<TypeParam> m(2, 2);
+  m(0, 1) = 255;
+  m(1, 0) = 7;
+
+  EXPECT_EQ(sizeof(*m.data()), sizeof(TypeParam));
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(m.data()) %
+                qp::rf::kFeatureAlignment,
+            0);
+  EXPECT_THAT(m.row(0).to_vector(), ElementsAre(0, 255));
+  EXPECT_THAT(m.column(0).to_vector(), ElementsAre(0, 7));
+}
+
+TEST_F(FeatureMatrixTest, TruncateSamples) {
+  for (const auto layout : {Layout::ROW_MAJOR, Layout::COLUMN_MAJOR}) {
+    FeatureMatrix m(3, 2, layout);
+    fill(m);
+    m.truncate_samples(2);
+
+    EXPECT_EQ(m.n_samples(), 2);
+    EXPECT_THAT(m.row(1).to_vector(), ElementsAre(10, 11));
+    EXPECT_THAT(m.column(1).to_vector(), ElementsAre(1, 11));
+  }
+}
+
+TEST_F(FeatureMatrixTest, MoveSamples) {
+  for (const auto layout : {Layout::ROW_MAJOR, Layout::COLUMN_MAJOR}) {
+    FeatureMatrix m(4, 2, layout);
+    fill(m);
+    m.move_samples(2, 1, 2);
+
+    EXPECT_THAT(m.column(0).to_vector(), ElementsAre(0, 20, 30, 30));
+    EXPECT_THAT(m.column(1).to_vector(), ElementsAre(1, 21, 31, 31));
+  }
+}
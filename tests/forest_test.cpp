@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "dataset.h"
+#include "deep_forest.h"
+#include "forest.h"
+#include "sparse.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class ForestTest : public ::testing::Test {};
+
+namespace {
+
+// More samples than fit in one block of a batch, with labels that trees
+// only partly agree on.
+template <typename T>
+qp::rf::DataSet<T> noisy_data_set(qp::rf::Layout layout) {
+  auto data_set = qp::rf::empty_data_set<T>(2000, 4, layout);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = (i * 7) % 100;
+    data_set.features(i, 1) = (i * 13) % 17 == 0 ? 0 : (i * 11) % 60;
+    data_set.features(i, 2) = (i * 3) % 5;
+    data_set.features(i, 3) = i % 2;
+    data_set.labels[i] = (data_set.features(i, 0) > 50) +
+                         2 * ((i * 31) % 7 == 0) + (i % 3 == 0);
+  }
+  return data_set;
+}
+
+// Predicts each sample of the dataset alone.
+template <typename Classifier, typename Matrix>
+std::vector<double> predict_each(Classifier& classifier,
+                                 const Matrix& features) {
+  std::vector<double> predictions;
+  for (auto i = 0ul; i < features.n_samples(); ++i) {
+    predictions.push_back(classifier.predict(features.row(i)));
+  }
+  return predictions;
+}
+
+}  // namespace
+
+TEST_F(ForestTest, PredictBatch) {
+  qp::threading::Threadpool thread_pool(3);
+  for (const auto layout :
+       {qp::rf::Layout::COLUMN_MAJOR, qp::rf::Layout::ROW_MAJOR}) {
+    const auto data_set = noisy_data_set<std::uint8_t>(layout);
+    qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> forest(
+        8, 6, &thread_pool);
+    forest.train(data_set);
+
+    // Batches are predicted exactly as samples one at a time, ties included.
+    const auto expected = predict_each(forest, data_set.features);
+    EXPECT_EQ(forest.predict_batch(data_set), expected);
+
+    const auto sparse = qp::rf::to_sparse(data_set);
+    EXPECT_EQ(forest.predict_batch(sparse), expected);
+
+    std::vector<double> predictions(data_set.size());
+    forest.predict_batch(data_set.features, predictions.data());
+    EXPECT_EQ(predictions, expected);
+  }
+}
+
+TEST_F(ForestTest, PredictBatchUnfrozen) {
+  // Multivariate splits cannot be frozen, so the trees predict themselves.
+  const auto data_set = noisy_data_set<double>(qp::rf::Layout::COLUMN_MAJOR);
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::RandomMultivariateSplit<2>> forest(
+      5, 6, &thread_pool);
+  forest.train(data_set);
+  EXPECT_EQ(forest.predict_batch(data_set),
+            predict_each(forest, data_set.features));
+}
+
+TEST_F(ForestTest, DeepForestPredictBatch) {
+  const auto data_set = noisy_data_set<double>(qp::rf::Layout::COLUMN_MAJOR);
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DeepForest<qp::rf::RandomUnivariateSplit> forest(
+      {4, 4, 1}, {{4, 4, 1}}, {4, -1, 1}, &thread_pool);
+  forest.train(data_set);
+  EXPECT_EQ(forest.predict_batch(data_set),
+            predict_each(forest, data_set.features));
+}
+
+TEST_F(ForestTest, TransformKeepsLeafIndices) {
+  // Trees of hundreds of leaves, whose indices narrow features would
+  // truncate.
+  auto data_set = qp::rf::empty_data_set<float>(2000, 2);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.features(i, 1) = (i * 7) % 101;
+    data_set.labels[i] = (i * 31) % 7;
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, float> forest(
+      2, -1, &thread_pool, 1, qp::rf::TreeType::DEEP_FOREST);
+  forest.train(data_set);
+
+  auto transformed = data_set;
+  forest.transform(transformed);
+  ASSERT_EQ(transformed.n_features(), 4);
+  float max_index = 0;
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    for (auto tree = 0ul; tree < forest.trees().size(); ++tree) {
+      const auto index = transformed.features(i, 2 + tree);
+      EXPECT_EQ(index, forest.trees()[tree].transform_summation(
+                           data_set.features.row(i)));
+      max_index = std::max(max_index, index);
+    }
+  }
+  EXPECT_GT(max_index, 255);
+}
@@ -0,0 +1,65 @@
+#include <cstdint>
+
+#include "dataset.h"
+#include "frozen_tree.h"
+#include "sparse.h"
+#include "split_fns.h"
+#include "tree.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class FrozenTreeTest : public ::testing::Test {};
+
+template <typename T>
+class TypedFrozenTreeTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedFrozenTreeTest, FeatureTypes);
+
+TYPED_TEST(TypedFrozenTreeTest, PredictsLikeTree) {
+  auto data_set = qp::rf::empty_data_set<TypeParam>(1000, 3);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = (i * 7) % 200;
+    data_set.features(i, 1) = (i * 13) % 100 == 0 ? 0 : (i * 11) % 50;
+    data_set.features(i, 2) = i % 3;
+    data_set.labels[i] = (i * 31) % 5;
+  }
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+  auto sample = qp::rf::sample_exactly(data_set);
+
+  qp::rf::DecisionTree<qp::rf::RandomUnivariateSplit, TypeParam> tree(-1, 1);
+  tree.train(qp::rf::TrainingData<TypeParam>{data_set, labels, counts},
+             sample);
+  const qp::rf::FrozenTree frozen(tree);
+
+  // Features are compared with thresholds exactly as the tree compares them,
+  // whatever their type, and whether the rows are dense or sparse.
+  const auto sparse = qp::rf::to_sparse(data_set);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    const auto features = data_set.features.row(i);
+    EXPECT_EQ(frozen.predict_class(features), tree.predict_class(features));
+    EXPECT_EQ(frozen.predict_class(sparse.features.row(i)),
+              tree.predict_class(features));
+  }
+}
+
+TEST_F(FrozenTreeTest, Layout) {
+  auto data_set = qp::rf::empty_data_set(4, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.labels[i] = i;
+  }
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+  auto sample = qp::rf::sample_exactly(data_set);
+
+  // Four labels take four leaves, and three nodes to split them.
+  qp::rf::DecisionTree<qp::rf::ExactUnivariateSplit<>> tree(-1, 1);
+  tree.train(qp::rf::TrainingData<double>{data_set, labels, counts}, sample);
+  const qp::rf::FrozenTree frozen(tree);
+  EXPECT_EQ(frozen.size(), 7);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    EXPECT_EQ(frozen.predict_class(data_set.features.row(i)), i);
+  }
+}
@@ -1,3 +1,5 @@
+#include <cstdint>
+
 #include "node.h"
 #include "dataset.h"
 #include "gtest/gmock.h"
@@ -7,9 +9,11 @@ class NodeTest : public ::testing::Test {};
 
 // Returns left if the first feature is greater than 0, and right otherwise.
 struct ConstSplitter {
-  void train(qp::rf::SDIter first, qp::rf::SDIter last) {}
+  template <typename T>
+  void train(const qp::rf::TrainingData<T>&, qp::rf::SDIter, qp::rf::SDIter) {}
 
-  qp::rf::SplitDirection apply(const std::vector<double>& e) const {
+  template <typename T>
+  qp::rf::SplitDirection apply(qp::rf::FeatureView<T> e) const {
     return e[0] > 0 ? qp::rf::SplitDirection::LEFT
                     : qp::rf::SplitDirection::RIGHT;
   }
@@ -21,28 +25,129 @@ TEST_F(NodeTest, Apply) {
   qp::rf::DecisionNode<ConstSplitter> node;
 
   auto data = qp::rf::empty_data_set(2, 2);
-  data[0].features = {-1, 1};
-  data[1].features = {1, 1};
+  data.features(0, 0) = -1;
+  data.features(0, 1) = 1;
+  data.features(1, 0) = 1;
+  data.features(1, 1) = 1;
+  data.labels = {1, 2};
 
   auto sampled = qp::rf::sample_exactly(data);
-  node.train(sampled.begin(), sampled.end());
+  const qp::rf::SampleCounts counts(data.size(), 1);
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/1);
 
-  EXPECT_EQ(node.split_direction(data[0].features),
+  EXPECT_EQ(node.split_direction(data.features.row(0)),
             qp::rf::SplitDirection::RIGHT);
-  EXPECT_EQ(node.split_direction(data[1].features),
+  EXPECT_EQ(node.split_direction(data.features.row(1)),
+            qp::rf::SplitDirection::LEFT);
+}
+
+TEST_F(NodeTest, PredictWeighted) {
+  qp::rf::DecisionNode<ConstSplitter> node;
+
+  auto data = qp::rf::empty_data_set(3, 2);
+  data.labels = {1, 1, 2};
+
+  // The last sample was drawn three times, which outweighs the other two.
+  auto sampled = qp::rf::sample_exactly(data);
+  const qp::rf::SampleCounts counts = {1, 1, 3};
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/3);
+  EXPECT_EQ(node.predict(), 2);
+  EXPECT_EQ(node.predict_class(), 1);
+}
+
+TEST_F(NodeTest, FixedClasses) {
+  qp::rf::DecisionNode<ConstSplitter, double, qp::rf::Classes<4>> node;
+
+  auto data = qp::rf::empty_data_set(3, 2);
+  data.features(2, 0) = 1;
+  data.labels = {3, 3, 8};
+
+  auto sampled = qp::rf::sample_exactly(data);
+  const qp::rf::SampleCounts counts(data.size(), 1);
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/1);
+  EXPECT_FALSE(node.leaf());
+  EXPECT_EQ(node.predict(), 3);
+  EXPECT_EQ(node.split_direction(data.features.row(2)),
+            qp::rf::SplitDirection::LEFT);
+}
+
+TEST_F(NodeTest, Criterion) {
+  qp::rf::DecisionNode<ConstSplitter, double, qp::rf::Classes<>,
+                       qp::rf::Entropy>
+      node;
+
+  auto data = qp::rf::empty_data_set(3, 2);
+  data.features(2, 0) = 1;
+  data.labels = {3, 3, 8};
+
+  auto sampled = qp::rf::sample_exactly(data);
+  const qp::rf::SampleCounts counts(data.size(), 1);
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/1);
+  EXPECT_FALSE(node.leaf());
+  EXPECT_EQ(node.split_direction(data.features.row(2)),
             qp::rf::SplitDirection::LEFT);
 }
 
+TEST_F(NodeTest, InseparableSamples) {
+  qp::rf::DecisionNode<ConstSplitter> node;
+
+  // Both samples go the same way whatever the splitter, so the node gives up
+  // and becomes a leaf.
+  auto data = qp::rf::empty_data_set(2, 2);
+  data.labels = {1, 2};
+
+  auto sampled = qp::rf::sample_exactly(data);
+  const qp::rf::SampleCounts counts(data.size(), 1);
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/1);
+  EXPECT_TRUE(node.leaf());
+}
+
 TEST_F(NodeTest, Predict) {
   qp::rf::DecisionNode<ConstSplitter> node;
 
   auto data = qp::rf::empty_data_set(4, 2);
-  data[0].label = 1;
-  data[1].label = 1;
-  data[2].label = 2;
-  data[3].label = 3;
+  data.labels = {1, 1, 2, 3};
 
+  // None of the samples can be separated, so make the node a leaf right away.
   auto sampled = qp::rf::sample_exactly(data);
-  node.train(sampled.begin(), sampled.end());
+  const qp::rf::SampleCounts counts(data.size(), 1);
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/4);
   EXPECT_EQ(node.predict(), 1);
 }
+
+template <typename T>
+class TypedNodeTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedNodeTest, FeatureTypes);
+
+TYPED_TEST(TypedNodeTest, Apply) {
+  qp::rf::DecisionNode<ConstSplitter, TypeParam> node;
+
+  auto data = qp::rf::empty_data_set<TypeParam>(2, 1);
+  data.features(1, 0) = 200;
+  data.labels = {1, 2};
+
+  auto sampled = qp::rf::sample_exactly(data);
+  const qp::rf::SampleCounts counts(data.size(), 1);
+  const auto labels = qp::rf::encode_labels(data.labels);
+  node.train({data, labels, counts}, sampled.begin(), sampled.end(),
+             /*leaf_threshold=*/1);
+
+  EXPECT_EQ(node.split_direction(data.features.row(0)),
+            qp::rf::SplitDirection::RIGHT);
+  EXPECT_EQ(node.split_direction(data.features.row(1)),
+            qp::rf::SplitDirection::LEFT);
+}
@@ -0,0 +1,90 @@
+#include <cstdint>
+
+#include "dataset.h"
+#include "forest.h"
+#include "presorted.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+
+class PresortedTest : public ::testing::Test {};
+
+template <typename T>
+class TypedPresortedTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedPresortedTest, FeatureTypes);
+
+TYPED_TEST(TypedPresortedTest, SortsEachFeature) {
+  auto data_set = qp::rf::empty_data_set<TypeParam>(4, 2);
+  data_set.features(0, 0) = 30;
+  data_set.features(1, 0) = 10;
+  data_set.features(2, 0) = 40;
+  data_set.features(3, 0) = 20;
+  data_set.features(0, 1) = 200;
+  data_set.features(2, 1) = 100;
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::PresortedFeatures<TypeParam> presorted(data_set, &thread_pool);
+
+  const auto* order = presorted.order(0);
+  EXPECT_THAT(std::vector<qp::rf::SampleIndex>(order, order + 4),
+              ElementsAre(1, 3, 0, 2));
+  // Ties keep their row order.
+  order = presorted.order(1);
+  EXPECT_THAT(std::vector<qp::rf::SampleIndex>(order, order + 4),
+              ElementsAre(1, 3, 2, 0));
+
+  EXPECT_EQ(presorted.low(0), 10);
+  EXPECT_EQ(presorted.high(0), 40);
+  EXPECT_EQ(presorted.low(1), 0);
+  EXPECT_EQ(presorted.high(1), 200);
+}
+
+TEST_F(PresortedTest, RangeMatchesScan) {
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(1000, 3);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    for (auto feature = 0ul; feature < 3; ++feature) {
+      data_set.features(i, feature) = (i * 37 + feature * 101) % 251;
+    }
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::PresortedFeatures<std::uint8_t> presorted(data_set,
+                                                          &thread_pool);
+
+  // Samples of every size, from the whole dataset down to a single row, both
+  // where the scan finds the ends and where it falls back to reading them.
+  for (const auto n : {1000ul, 900ul, 300ul, 20ul, 1ul}) {
+    qp::rf::SampleCounts counts;
+    auto sample = qp::rf::sample_without_replacement(data_set, n, &counts);
+    for (auto feature = 0ul; feature < 3; ++feature) {
+      EXPECT_EQ(
+          presorted.range(data_set, sample.begin(), sample.end(), feature),
+          qp::rf::feature_range(data_set, sample.begin(), sample.end(),
+                                feature));
+    }
+  }
+}
+
+TEST_F(PresortedTest, TrainForest) {
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(200, 2);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.features(i, 1) = 199 - i;
+    data_set.labels[i] = i < 100;
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::PresortedFeatures<std::uint8_t> presorted(data_set,
+                                                          &thread_pool);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> forest(
+      5, -1, &thread_pool);
+  forest.train(data_set, presorted);
+
+  EXPECT_EQ(forest.predict(data_set.features.row(0)), 1);
+  EXPECT_EQ(forest.predict(data_set.features.row(199)), 0);
+}
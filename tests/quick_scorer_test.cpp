@@ -0,0 +1,66 @@
+#include <cstdint>
+
+#include "dataset.h"
+#include "forest.h"
+#include "quick_scorer.h"
+#include "sparse.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class QuickScorerTest : public ::testing::Test {};
+
+template <typename T>
+class TypedQuickScorerTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedQuickScorerTest, FeatureTypes);
+
+TYPED_TEST(TypedQuickScorerTest, PredictsLikeForest) {
+  auto data_set = qp::rf::empty_data_set<TypeParam>(3000, 6);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    for (auto feature = 0ul; feature < data_set.n_features(); ++feature) {
+      data_set.features(i, feature) = (i * (7 + 6 * feature)) % 101;
+    }
+    data_set.labels[i] = (i * 31) % 4;
+  }
+
+  // Shallow trees fit a word per bitvector, and deeper ones take several.
+  qp::threading::Threadpool thread_pool(2);
+  for (const auto depth : {3, 10}) {
+    qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, TypeParam> forest(
+        10, depth, &thread_pool);
+    forest.train(data_set);
+    const qp::rf::QuickScorer scorer(forest);
+
+    const auto sparse = qp::rf::to_sparse(data_set);
+    for (auto i = 0ul; i < data_set.size(); ++i) {
+      const auto features = data_set.features.row(i);
+      EXPECT_EQ(scorer.predict(features), forest.predict(features));
+      EXPECT_EQ(scorer.predict(sparse.features.row(i)),
+                forest.predict(features));
+    }
+  }
+}
+
+TEST_F(QuickScorerTest, ThresholdsOnValues) {
+  // Exact splits put thresholds halfway between values.  Samples on each
+  // threshold, and either side of it, exit at the same leaf as the walk.
+  auto data_set = qp::rf::empty_data_set(200, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.labels[i] = (i / 10) % 3;
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::ExactUnivariateSplit<>> forest(
+      3, 8, &thread_pool);
+  forest.train(data_set);
+  const qp::rf::QuickScorer scorer(forest);
+  for (auto i = 0; i < 400; ++i) {
+    const std::vector<double> features = {i / 2.0};
+    EXPECT_EQ(scorer.predict(qp::rf::FeatureView<double>(features)),
+              forest.predict(features));
+  }
+}
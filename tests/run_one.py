@@ -2,7 +2,7 @@ import fnmatch
 import os
 import sys
 
-COMPILE_FMT = "g++ {0} gtest/gmock-gtest-all.o gtest/gtest_main.o -I../ -lopencv_core"
+COMPILE_FMT = "g++ -pedantic-errors {0} gtest/gmock-gtest-all.o gtest/gtest_main.o -I../ -lopencv_core"
 
 def main():
     f = sys.argv[1]
@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <string>
+
+#include "csv.h"
+#include "dataset.h"
+#include "forest.h"
+#include "sparse.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+class SparseTest : public ::testing::Test {};
+
+namespace {
+
+// Two features which decide the label, among many which are mostly zero.
+qp::rf::DataSet<std::uint8_t> mostly_zero_data_set() {
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(300, 40);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 3) = i % 3 == 0 ? 0 : (i * 7) % 100;
+    data_set.features(i, 17) = i % 5 == 0 ? 0 : (i * 11) % 100;
+    data_set.features(i, 20 + i % 20) = i % 13;
+    data_set.labels[i] =
+        (data_set.features(i, 3) >= 50) + 2 * (data_set.features(i, 17) < 30);
+  }
+  return data_set;
+}
+
+}  // namespace
+
+TEST_F(SparseTest, Rows) {
+  const qp::rf::SparseFeatureMatrix<double> matrix(5, {0, 2, 2, 3},
+                                                   {1, 4, 0}, {2.5, -1, 7});
+  EXPECT_EQ(matrix.n_samples(), 3);
+  EXPECT_EQ(matrix.n_features(), 5);
+  EXPECT_EQ(matrix.n_nonzero(), 3);
+
+  EXPECT_EQ(matrix.row(0)[1], 2.5);
+  EXPECT_EQ(matrix.row(0)[2], 0);
+  EXPECT_EQ(matrix(0, 4), -1);
+  EXPECT_EQ(matrix.row(1).n_nonzero(), 0);
+  EXPECT_THAT(matrix.row(0).to_vector(), ElementsAre(0, 2.5, 0, 0, -1));
+  EXPECT_THAT(matrix.row(1).to_vector(), ElementsAre(0, 0, 0, 0, 0));
+  EXPECT_THAT(matrix.row(2).to_vector(), ElementsAre(7, 0, 0, 0, 0));
+}
+
+TEST_F(SparseTest, ColumnsMatchDense) {
+  const auto data_set = mostly_zero_data_set();
+  const auto sparse = qp::rf::to_sparse(data_set);
+  ASSERT_EQ(sparse.size(), data_set.size());
+  ASSERT_EQ(sparse.n_features(), data_set.n_features());
+
+  auto n_nonzero = 0ul;
+  for (auto feature = 0ul; feature < data_set.n_features(); ++feature) {
+    const auto column = sparse.features.column(feature);
+    n_nonzero += column.n_nonzero();
+    for (auto i = 0ul; i < column.n_nonzero(); ++i) {
+      if (i > 0) {
+        EXPECT_LT(column.samples()[i - 1], column.samples()[i]);
+      }
+      EXPECT_NE(column.values()[i], 0);
+      EXPECT_EQ(column.values()[i],
+                data_set.features(column.samples()[i], feature));
+    }
+  }
+  EXPECT_EQ(n_nonzero, sparse.features.n_nonzero());
+
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    EXPECT_EQ(sparse.features.row(i).to_vector(),
+              data_set.features.row(i).to_vector());
+  }
+}
+
+TEST_F(SparseTest, FeatureRange) {
+  const qp::rf::SparseDataSet<double> data_set = {
+      qp::rf::SparseFeatureMatrix<double>(2, {0, 1, 2, 3, 3}, {0, 0, 1},
+                                          {3, 5, -2}),
+      {0, 1, 0, 1}};
+  qp::rf::SampledDataSet all = {0, 1, 2, 3};
+  qp::rf::SampledDataSet stored = {0, 1};
+
+  // Samples without a stored value count as zero.
+  EXPECT_EQ(qp::rf::feature_range(data_set, all.begin(), all.end(), 0),
+            std::make_pair(0.0, 5.0));
+  EXPECT_EQ(qp::rf::feature_range(data_set, stored.begin(), stored.end(), 0),
+            std::make_pair(3.0, 5.0));
+  EXPECT_EQ(qp::rf::feature_range(data_set, all.begin(), all.end(), 1),
+            std::make_pair(-2.0, 0.0));
+}
+
+TEST_F(SparseTest, ReadCsv) {
+  const std::string csv =
+      "1, 0, 3, 0\n"
+      "2, 0, 0, 0\n"
+      "1, x, 0, 0\n"
+      "\n"
+      "0, 4.5, 0, 6\n";
+
+  std::vector<qp::rf::MalformedRow> malformed;
+  const auto data_set = qp::rf::read_sparse_csv_data_set(
+      csv.data(), csv.data() + csv.size(), &malformed);
+
+  ASSERT_EQ(data_set.size(), 3);
+  EXPECT_EQ(data_set.n_features(), 3);
+  EXPECT_EQ(data_set.features.n_nonzero(), 3);
+  EXPECT_THAT(data_set.labels, ElementsAre(1, 2, 0));
+  EXPECT_THAT(data_set.features.row(0).to_vector(), ElementsAre(0, 3, 0));
+  EXPECT_THAT(data_set.features.row(1).to_vector(), ElementsAre(0, 0, 0));
+  EXPECT_THAT(data_set.features.row(2).to_vector(), ElementsAre(4.5, 0, 6));
+
+  ASSERT_EQ(malformed.size(), 1);
+  EXPECT_EQ(malformed[0].line, 3);
+}
+
+TEST_F(SparseTest, ReadCsvLeadingBlankLine) {
+  const std::string csv = "\n1, 0, 3\n0, 4.5, 0\n";
+
+  std::vector<qp::rf::MalformedRow> malformed;
+  const auto data_set = qp::rf::read_sparse_csv_data_set(
+      csv.data(), csv.data() + csv.size(), &malformed);
+
+  EXPECT_TRUE(malformed.empty());
+  ASSERT_EQ(data_set.size(), 2);
+  EXPECT_EQ(data_set.n_features(), 2);
+  EXPECT_THAT(data_set.labels, ElementsAre(1, 0));
+  EXPECT_THAT(data_set.features.row(1).to_vector(), ElementsAre(4.5, 0));
+}
+
+TEST_F(SparseTest, TrainForests) {
+  const auto data_set = mostly_zero_data_set();
+  const auto sparse = qp::rf::to_sparse(data_set);
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::ExactUnivariateSplit<>, std::uint8_t> exact(
+      5, -1, &thread_pool);
+  exact.train(sparse);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> random(
+      5, -1, &thread_pool);
+  random.train(sparse);
+
+  auto exact_correct = 0, random_correct = 0;
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    const auto row = sparse.features.row(i);
+    // Sparse and dense rows walk the trees the same way.
+    EXPECT_EQ(exact.predict(row), exact.predict(data_set.features.row(i)));
+    exact_correct += exact.predict(row) == data_set.labels[i];
+    random_correct += random.predict(row) == data_set.labels[i];
+  }
+  EXPECT_GT(exact_correct, 285);
+  EXPECT_GT(random_correct, 285);
+}
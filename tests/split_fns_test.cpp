@@ -0,0 +1,119 @@
+#include <cstdint>
+#include <limits>
+
+#include "dataset.h"
+#include "forest.h"
+#include "presorted.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class SplitFnsTest : public ::testing::Test {};
+
+template <typename T>
+class TypedSplitFnsTest : public ::testing::Test {};
+
+using FeatureTypes = ::testing::Types<double, float, std::uint8_t>;
+TYPED_TEST_CASE(TypedSplitFnsTest, FeatureTypes);
+
+TYPED_TEST(TypedSplitFnsTest, ExactThreshold) {
+  // Labels change at 60, apart from one noisy sample, and every value occurs
+  // twice.
+  auto data_set = qp::rf::empty_data_set<TypeParam>(200, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i / 2;
+    data_set.labels[i] = i / 2 >= 60;
+  }
+  data_set.labels[20] = 1;
+
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+  auto sample = qp::rf::sample_exactly(data_set);
+
+  qp::rf::ExactUnivariateSplit<> split;
+  split.train(qp::rf::TrainingData<TypeParam>{data_set, labels, counts},
+              sample.begin(), sample.end());
+  EXPECT_EQ(split.threshold(), 59.5);
+  // Only the noisy sample is misplaced: 120 samples of which one is impure.
+  EXPECT_NEAR(split.impurity(), 0.6 * (2 * (1 / 120.0) * (119 / 120.0)),
+              1e-12);
+
+  // Reading the samples off the presorted order finds the same split.
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::PresortedFeatures<TypeParam> presorted(data_set,
+                                                       &thread_pool);
+  qp::rf::ExactUnivariateSplit<> presorted_split;
+  presorted_split.train(
+      qp::rf::TrainingData<TypeParam>{data_set, labels, counts, &presorted},
+      sample.begin(), sample.end());
+  EXPECT_EQ(presorted_split.threshold(), split.threshold());
+  EXPECT_EQ(presorted_split.impurity(), split.impurity());
+}
+
+TEST_F(SplitFnsTest, ExactSubset) {
+  auto data_set = qp::rf::empty_data_set(10, 1);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = 99 - i;
+    data_set.labels[i] = i % 2;
+  }
+
+  // Only the samples of the node are split, weighted by their counts.  The
+  // sample of value 97 was drawn three times, which moves the best split from
+  // below 96 to above 97.
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  qp::rf::SampleCounts counts(data_set.size(), 0);
+  qp::rf::SampledDataSet sample = {1, 2, 3, 4};
+  for (const auto row : sample) counts[row] = 1;
+  counts[2] = 3;
+
+  // The node holds enough of the dataset to be read off the presorted order.
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::PresortedFeatures<double> presorted(data_set, &thread_pool);
+  for (const auto* sorted :
+       {&presorted, static_cast<decltype(&presorted)>(nullptr)}) {
+    qp::rf::ExactUnivariateSplit<> split;
+    split.train(qp::rf::TrainingData<double>{data_set, labels, counts, sorted},
+                sample.begin(), sample.end());
+    EXPECT_EQ(split.threshold(), 97.5);
+    EXPECT_NEAR(split.impurity(), 1.6 / 6, 1e-12);
+  }
+}
+
+TEST_F(SplitFnsTest, ExactSingleValue) {
+  auto data_set = qp::rf::empty_data_set(3, 1);
+  data_set.labels = {1, 2, 3};
+
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+  auto sample = qp::rf::sample_exactly(data_set);
+
+  qp::rf::ExactUnivariateSplit<qp::rf::Entropy> split;
+  split.train(qp::rf::TrainingData<double>{data_set, labels, counts},
+              sample.begin(), sample.end());
+  EXPECT_EQ(split.impurity(), std::numeric_limits<double>::infinity());
+}
+
+TEST_F(SplitFnsTest, ExactTrainsShallowerTrees) {
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(200, 2);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = i;
+    data_set.features(i, 1) = (i * 37) % 200;
+    data_set.labels[i] = (i < 100) + 2 * (data_set.features(i, 1) < 50);
+  }
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::ExactUnivariateSplit<>, std::uint8_t> exact(
+      5, -1, &thread_pool);
+  exact.train(data_set);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> random(
+      5, -1, &thread_pool);
+  random.train(data_set);
+
+  auto correct = 0;
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    correct += exact.predict(data_set.features.row(i)) == data_set.labels[i];
+  }
+  EXPECT_GT(correct, 190);
+  EXPECT_LT(exact.average_depth(), random.average_depth());
+}
@@ -0,0 +1,97 @@
+#include <unistd.h>
+
+#include <cstdint>
+#include <string>
+
+#include "binary_dataset.h"
+#include "forest.h"
+#include "split_fns.h"
+#include "streaming.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class StreamingTest : public ::testing::Test {
+ protected:
+  StreamingTest() : thread_pool_(4) {
+    char path[] = "/tmp/streaming_test_XXXXXX";
+    close(mkstemp(path));
+    path_ = path;
+
+    // The label is decided by which side of 128 the first two features fall,
+    // and the third feature is noise.
+    data_set_ = qp::rf::empty_data_set<std::uint8_t>(300, 3);
+    for (auto i = 0ul; i < data_set_.size(); ++i) {
+      for (auto feature = 0ul; feature < 3; ++feature) {
+        data_set_.features(i, feature) = (i * 37 + feature * 101) % 256;
+      }
+      data_set_.labels[i] = (data_set_.features(i, 0) < 128) +
+                            2 * (data_set_.features(i, 1) < 128);
+    }
+    qp::rf::write_binary_data_set(data_set_, path_);
+  }
+
+  ~StreamingTest() { unlink(path_.c_str()); }
+
+  // The fraction of the dataset the forest predicts correctly.
+  template <typename Forest>
+  double accuracy(Forest& forest) {
+    auto correct = 0;
+    for (auto i = 0ul; i < data_set_.size(); ++i) {
+      correct +=
+          forest.predict(data_set_.features.row(i)) == data_set_.labels[i];
+    }
+    return correct / static_cast<double>(data_set_.size());
+  }
+
+  qp::threading::Threadpool thread_pool_;
+  std::string path_;
+  qp::rf::DataSet<std::uint8_t> data_set_;
+};
+
+TEST_F(StreamingTest, FitsTrainingData) {
+  qp::rf::BinaryDataSource<std::uint8_t> source(path_);
+  ASSERT_TRUE(static_cast<bool>(source));
+
+  // From a budget of a few samples, which streams every level, to one which
+  // holds the whole dataset.  Each tree only sees a bootstrap sample, so a few
+  // samples may be missed.
+  const auto sample_bytes = 3 + sizeof(double);
+  for (const auto budget_samples : {2ul, 40ul, 1000ul}) {
+    qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t>
+        forest(5, -1, &thread_pool_);
+    ASSERT_TRUE(forest.train(source, budget_samples * sample_bytes));
+    EXPECT_GT(accuracy(forest), 0.95);
+  }
+}
+
+TEST_F(StreamingTest, SampleFraction) {
+  qp::rf::BinaryDataSource<std::uint8_t> source(path_);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> forest(
+      5, -1, &thread_pool_, 1, qp::rf::TreeType::SINGLE_FOREST, 0.5);
+  ASSERT_TRUE(forest.train(source, 40 * (3 + sizeof(double))));
+  EXPECT_GT(accuracy(forest), 0.9);
+}
+
+TEST_F(StreamingTest, FixedClasses) {
+  qp::rf::BinaryDataSource<std::uint8_t> source(path_);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t,
+                         qp::rf::Classes<4>>
+      forest(5, -1, &thread_pool_);
+  ASSERT_TRUE(forest.train(source, 40 * (3 + sizeof(double))));
+  EXPECT_GT(accuracy(forest), 0.95);
+
+  // Histograms may have room for more classes than the source has labels.
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t,
+                         qp::rf::Classes<8>>
+      wider(5, -1, &thread_pool_);
+  ASSERT_TRUE(wider.train(source, 40 * (3 + sizeof(double))));
+  EXPECT_GT(accuracy(wider), 0.95);
+}
+
+TEST_F(StreamingTest, MaxDepth) {
+  qp::rf::BinaryDataSource<std::uint8_t> source(path_);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> forest(
+      2, 1, &thread_pool_);
+  ASSERT_TRUE(forest.train(source, 0));
+  EXPECT_EQ(forest.average_depth(), 1);
+}
@@ -0,0 +1,172 @@
+#include <pthread.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+
+#include "dataset.h"
+#include "forest.h"
+#include "presorted.h"
+#include "split_fns.h"
+#include "threadpool.h"
+#include "tree.h"
+#include "gtest/gmock.h"
+#include "gtest/gtest.h"
+
+class TreeTest : public ::testing::Test {};
+
+namespace {
+
+qp::rf::DataSet<std::uint8_t> checkerboard_data_set(std::size_t n_samples) {
+  auto data_set = qp::rf::empty_data_set<std::uint8_t>(n_samples, 2);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    data_set.features(i, 0) = (i * 7) % 256;
+    data_set.features(i, 1) = (i * 13) % 256;
+    data_set.labels[i] =
+        (data_set.features(i, 0) / 64 + data_set.features(i, 1) / 64) % 2;
+  }
+  return data_set;
+}
+
+}  // namespace
+
+TEST_F(TreeTest, TrainOnThreadPool) {
+  const auto data_set = checkerboard_data_set(5000);
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+
+  // A single thread has to run the subtree tasks of a node while it waits on
+  // them.
+  for (const auto n_threads : {1, 4}) {
+    qp::threading::Threadpool thread_pool(n_threads);
+    qp::rf::DecisionTree<qp::rf::RandomUnivariateSplit, std::uint8_t> tree(
+        -1, 1);
+    auto sample = qp::rf::sample_exactly(data_set);
+    tree.train(
+        qp::rf::TrainingData<std::uint8_t>{data_set, labels, counts}, sample,
+        &thread_pool);
+    EXPECT_GT(tree.depth(), 2);
+
+    // Every training sample reaches a pure leaf, and leaves are numbered
+    // consecutively from zero.  Splits never leave a child empty, so every
+    // leaf is reached.
+    std::set<int> leaves;
+    for (auto i = 0ul; i < data_set.size(); ++i) {
+      const auto features = data_set.features.row(i);
+      EXPECT_EQ(tree.predict(features), data_set.labels[i]);
+      leaves.insert(tree.transform_summation(features));
+    }
+    EXPECT_EQ(*leaves.begin(), 0);
+    EXPECT_EQ(*leaves.rbegin(), leaves.size() - 1);
+  }
+}
+
+TEST_F(TreeTest, SingleTreeForest) {
+  const auto data_set = checkerboard_data_set(5000);
+
+  qp::threading::Threadpool thread_pool(3);
+  qp::rf::DecisionForest<qp::rf::ExactUnivariateSplit<>, std::uint8_t> forest(
+      1, -1, &thread_pool, 1, qp::rf::TreeType::SINGLE_FOREST, 0.5);
+  forest.train(data_set);
+
+  auto correct = 0;
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    correct += forest.predict(data_set.features.row(i)) == data_set.labels[i];
+  }
+  EXPECT_GT(correct, 4900);
+}
+
+TEST_F(TreeTest, TrainLevelWise) {
+  const auto data_set = checkerboard_data_set(5000);
+  const auto labels = qp::rf::encode_labels(data_set.labels);
+  const qp::rf::SampleCounts counts(data_set.size(), 1);
+
+  qp::threading::Threadpool thread_pool(3);
+  for (auto* pool : {&thread_pool, static_cast<decltype(&thread_pool)>(
+                                       nullptr)}) {
+    qp::rf::DecisionTree<qp::rf::RandomUnivariateSplit, std::uint8_t> tree(
+        -1, 1, qp::rf::TreeType::SINGLE_FOREST,
+        qp::rf::TreeGrowth::LEVEL_WISE);
+    auto sample = qp::rf::sample_exactly(data_set);
+    tree.train(
+        qp::rf::TrainingData<std::uint8_t>{data_set, labels, counts}, sample,
+        pool);
+    EXPECT_GT(tree.depth(), 2);
+
+    std::set<int> leaves;
+    for (auto i = 0ul; i < data_set.size(); ++i) {
+      const auto features = data_set.features.row(i);
+      EXPECT_EQ(tree.predict(features), data_set.labels[i]);
+      leaves.insert(tree.transform_summation(features));
+    }
+    EXPECT_EQ(*leaves.begin(), 0);
+    EXPECT_EQ(*leaves.rbegin(), leaves.size() - 1);
+
+    // The sample is only reordered.
+    std::sort(sample.begin(), sample.end());
+    EXPECT_EQ(sample, qp::rf::sample_exactly(data_set));
+  }
+}
+
+TEST_F(TreeTest, LevelWiseLimitsDepth) {
+  const auto data_set = checkerboard_data_set(5000);
+
+  qp::threading::Threadpool thread_pool(2);
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, std::uint8_t> forest(
+      3, 4, &thread_pool, 1, qp::rf::TreeType::SINGLE_FOREST, 1,
+      qp::rf::TreeGrowth::LEVEL_WISE);
+  forest.train(data_set);
+  EXPECT_LE(forest.average_depth(), 4);
+  EXPECT_GT(forest.average_depth(), 0);
+}
+
+TEST_F(TreeTest, LevelWisePresorted) {
+  // Presorted lookups need every node's samples in increasing order, which
+  // the level wise partition keeps.
+  const auto data_set = checkerboard_data_set(5000);
+
+  qp::threading::Threadpool thread_pool(2);
+  const qp::rf::PresortedFeatures<std::uint8_t> presorted(data_set,
+                                                          &thread_pool);
+  qp::rf::DecisionForest<qp::rf::ExactUnivariateSplit<>, std::uint8_t> forest(
+      2, -1, &thread_pool, 1, qp::rf::TreeType::SINGLE_FOREST, 1,
+      qp::rf::TreeGrowth::LEVEL_WISE);
+  forest.train(data_set, presorted);
+
+  auto correct = 0;
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    correct += forest.predict(data_set.features.row(i)) == data_set.labels[i];
+  }
+  EXPECT_GT(correct, 4900);
+}
+
+TEST_F(TreeTest, ManyTreesOnOneThread) {
+  // Every tree is queued before any of their subtrees.  A tree waiting on its
+  // subtree must not run the next tree in the meantime, or on a single thread
+  // each tree nests inside the last, until the worker's stack overflows.
+  // The worker is given a small stack, so that nesting a few dozen trees
+  // would.
+  auto data_set = qp::rf::empty_data_set<float>(2048, 4);
+  for (auto i = 0ul; i < data_set.size(); ++i) {
+    for (auto feature = 0ul; feature < data_set.n_features(); ++feature) {
+      data_set.features(i, feature) = (i * (13 + 2 * feature)) % 1009;
+    }
+    data_set.labels[i] = (i * 31) % 5;
+  }
+
+  pthread_attr_t default_attr, small_stack;
+  ASSERT_EQ(pthread_getattr_default_np(&default_attr), 0);
+  pthread_attr_init(&small_stack);
+  pthread_attr_setstacksize(&small_stack, 64 << 10);
+  ASSERT_EQ(pthread_setattr_default_np(&small_stack), 0);
+  qp::threading::Threadpool thread_pool(1);
+  pthread_setattr_default_np(&default_attr);
+  pthread_attr_destroy(&small_stack);
+  pthread_attr_destroy(&default_attr);
+
+  qp::rf::DecisionForest<qp::rf::RandomUnivariateSplit, float> forest(
+      30, -1, &thread_pool);
+  forest.train(data_set);
+  EXPECT_EQ(forest.trees().size(), 30);
+  EXPECT_GT(forest.average_depth(), 2);
+}
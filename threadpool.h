@@ -1,9 +1,14 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
-#include <queue>
+#include <mutex>
 #include <thread>
+#include <vector>
 
 namespace qp {
 namespace threading {
@@ -22,6 +27,20 @@ class Threadpool {
   auto add(F&& f, Args&&... args) ->
       typename std::future<typename std::result_of<F(Args...)>::type>;
 
+  std::size_t n_threads() const { return threads_.size(); }
+
+  // Waits for the result of a task, running queued tasks on the calling thread
+  // until it is ready.  Tasks which wait on tasks they added must wait this
+  // way, since blocking would deadlock once every thread was waiting.
+  template <typename R>
+  R wait(std::future<R>& future);
+
+  // Runs the most recently queued task on the calling thread.  Returns false
+  // if there was none.  A task waiting this way is most likely to run the
+  // work it just added, rather than an unrelated task, such as a whole tree,
+  // which would nest on its stack and hold up its own wait until finished.
+  bool run_pending_task();
+
   // Shuts down the threadpool.  All tasks currently being executed will finish
   // and all threads will be joined.  All tasks still in the queue will be
   // aborted, and their futures will be invalidated.
@@ -30,7 +49,9 @@ class Threadpool {
  private:
   std::vector<std::thread> threads_;
   bool shutdown_ = false;
-  std::queue<std::function<void()>> work_queue_;
+  // Workers take tasks from the front, in the order they were added, and
+  // waiting tasks from the back.
+  std::deque<std::function<void()>> work_queue_;
   std::mutex mu_;
   std::condition_variable work_added_;
 
@@ -56,13 +77,37 @@ auto Threadpool::add(F&& f, Args&&... args) ->
 
   {
     std::lock_guard<std::mutex> lock(mu_);
-    work_queue_.emplace([work]() { (*work)(); });
+    work_queue_.emplace_back([work]() { (*work)(); });
   }
 
   work_added_.notify_one();
   return ret;
 }
 
+template <typename R>
+R Threadpool::wait(std::future<R>& future) {
+  while (future.wait_for(std::chrono::seconds(0)) !=
+         std::future_status::ready) {
+    // The task is running on another thread.  It may yet queue work of its
+    // own, so check back rather than blocking until it finishes.
+    if (!run_pending_task()) future.wait_for(std::chrono::microseconds(100));
+  }
+  return future.get();
+}
+
+bool Threadpool::run_pending_task() {
+  std::function<void()> work;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (shutdown_ || work_queue_.empty()) return false;
+    work = std::move(work_queue_.back());
+    work_queue_.pop_back();
+  }
+
+  work();
+  return true;
+}
+
 void Threadpool::worker() {
   while (true) {
     std::function<void()> work;
@@ -74,7 +119,7 @@ void Threadpool::worker() {
       if (shutdown_) return;
 
       work = std::move(work_queue_.front());
-      work_queue_.pop();
+      work_queue_.pop_front();
     }
 
     work();
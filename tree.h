@@ -3,8 +3,15 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "arena.h"
 #include "dataset.h"
 #include "node.h"
+#include "sparse.h"
+#include "threadpool.h"
 
 namespace qp {
 namespace rf {
@@ -14,24 +21,39 @@ namespace rf {
 // just in case.
 enum class TreeType { SINGLE_FOREST, DEEP_FOREST };
 
-// A complete tree of DecisionNodes.
-template <typename SplitterFn>
+// The order a tree's nodes are trained in.  Depth first trains a node and
+// then each of its subtrees in turn.  Level wise trains every node of a level
+// before any of the next, sweeping the samples of the whole level in order
+// and partitioning them all in a single pass, and trains the nodes of a level
+// in parallel when given a thread pool.
+enum class TreeGrowth { DEPTH_FIRST, LEVEL_WISE };
+
+// A complete tree of DecisionNodes, trained on features of type T with
+// ClassesT classes, whose splits are chosen by CriterionT.
+template <typename SplitterFn, typename T = double,
+          typename ClassesT = Classes<>, typename CriterionT = Gini>
 class DecisionTree {
  public:
+  using Node = DecisionNode<SplitterFn, T, ClassesT, CriterionT>;
+  using Splitter = SplitterFn;
+
   // Create a DecisionTree with a given depth and leaf threshold.  Passing
   // -1 as the depth will cause the tree to be fully grown.
   DecisionTree(int max_depth, int leaf_threshold,
-               TreeType type = TreeType::SINGLE_FOREST)
+               TreeType type = TreeType::SINGLE_FOREST,
+               TreeGrowth growth = TreeGrowth::DEPTH_FIRST)
       : max_depth_(max_depth),
-        type_(type),
-        leaf_threshold_(leaf_threshold),
         depth_(0),
+        leaf_threshold_(leaf_threshold),
+        type_(type),
+        growth_(growth),
         n_leaves_(0) {}
 
-  // Walks the tree based on the feature vector and returns the leaf node.
-  const DecisionNode<SplitterFn>* walk(
-      const std::vector<double>& features) const {
-    const auto* current = root_.get();
+  // Walks the tree based on the feature vector, a FeatureView or a
+  // SparseRow, and returns the leaf node.
+  template <typename Features>
+  const Node* walk(const Features& features) const {
+    const auto* current = root_;
     // Start at the root node and walk down the tree until we reach a leaf.
     while (!current->leaf()) {
       const auto dir = current->split_direction(features);
@@ -41,55 +63,109 @@ class DecisionTree {
   }
 
   // Predict the label for a set of features.
-  double predict(const std::vector<double>& features) const {
+  double predict(FeatureView<T> features) const {
     return walk(features)->predict();
   }
 
-  // Train the tree on the given dataset.
-  void train(SampledDataSet& data_set) {
-    root_.reset(new DecisionNode<SplitterFn>());
-    train_recurse(root_.get(), data_set.begin(), data_set.end(), 0);
+  double predict(const SparseRow<T>& features) const {
+    return walk(features)->predict();
+  }
+
+  // Predict the class of the label for a set of features, in the encoding the
+  // tree was trained with.
+  ClassIndex predict_class(FeatureView<T> features) const {
+    return walk(features)->predict_class();
+  }
+
+  ClassIndex predict_class(const SparseRow<T>& features) const {
+    return walk(features)->predict_class();
+  }
+
+  // Train the tree on the given sample of the dataset, which is either dense
+  // or sparse.  The sample is reordered as the tree is grown.  Given a thread
+  // pool, the subtrees of large nodes, or the nodes of a level when growing
+  // level wise, are trained as separate tasks on it, so that a single tree can
+  // keep several threads busy.
+  template <typename DataSetT>
+  void train(const TrainingData<T, DataSetT>& training, SampledDataSet& sample,
+             qp::threading::Threadpool* thread_pool = nullptr) {
+    reset_nodes();
+    if (growth_ == TreeGrowth::LEVEL_WISE) {
+      train_level_wise(training, sample, thread_pool);
+      index_leaves(root_);
+      return;
+    }
+    if (thread_pool == nullptr) {
+      train_recurse(root_, training, sample.begin(), sample.end(), 0);
+      return;
+    }
+
+    record_depth(train_parallel(root_, training, sample.begin(),
+                                sample.end(), 0, thread_pool));
+    // Leaves finish in no particular order, so they are numbered afterwards,
+    // in the order train_recurse would have numbered them.
+    index_leaves(root_);
+  }
+
+  // Replaces the tree with a single untrained root node and returns it.  For
+  // trainers which build the tree themselves, such as the streaming trainer.
+  Node* reset_root() {
+    reset_nodes();
+    depth_ = 0;
+    n_leaves_ = 0;
+    return root_;
+  }
+
+  // Makes an untrained child of a node of this tree and returns it.  Safe to
+  // call from several threads at once.
+  Node* make_child(Node* parent, SplitDirection dir) {
+    auto* child = nodes_.make();
+    parent->set_child(dir, child);
+    return child;
+  }
+
+  // Records that the tree has grown to at least the given depth.
+  void record_depth(int depth) { depth_ = std::max(depth_, depth); }
+
+  // Turns a node of this tree into a leaf and gives it the next leaf index.
+  void finish_leaf(Node* node) {
+    node->make_leaf();
+    node->set_index(n_leaves_);
+    ++n_leaves_;
   }
 
   // Eliminating the explicit recursion did not provide any speed ups.  The
   // depth is pretty shallow.
-  void train_recurse(DecisionNode<SplitterFn>* current, SDIter first,
-                     SDIter last, int current_depth) {
-    // Record the current depth.
-    depth_ = std::max(depth_, current_depth);
+  template <typename DataSetT>
+  void train_recurse(Node* current, const TrainingData<T, DataSetT>& training,
+                     SDIter first, SDIter last, int current_depth) {
+    record_depth(current_depth);
 
     // Train the current node.
-    current->train(first, last, leaf_threshold_);
+    current->train(training, first, last, leaf_threshold_);
 
     if (current->leaf() || current_depth == max_depth_) {
-      current->make_leaf();
-      current->set_index(n_leaves_);
-      ++n_leaves_;
+      finish_leaf(current);
       return;
     }
 
-    // Partition the dataset so that all LEFT examples are before all RIGHT
-    // examples.
-    auto pivot_iter = std::partition(first, last, [&](const auto& sample) {
-      return current->split_direction(sample.get().features) ==
-             SplitDirection::LEFT;
-    });
+    const auto pivot_iter = partition(*current, training, first, last);
 
     // Train the left and right nodes on the portion of the data that was split
     // to them.
-    train_recurse(current->make_child(SplitDirection::LEFT), first, pivot_iter,
-                  current_depth + 1);
-    train_recurse(current->make_child(SplitDirection::RIGHT), pivot_iter, last,
-                  current_depth + 1);
+    train_recurse(make_child(current, SplitDirection::LEFT), training, first,
+                  pivot_iter, current_depth + 1);
+    train_recurse(make_child(current, SplitDirection::RIGHT), training,
+                  pivot_iter, last, current_depth + 1);
   }
 
   // Transform features and produce an augmented feature.
   // Note: This is experimental and only used for deep-rfs.
-  double transform_summation(const std::vector<double>& features) const {
+  double transform_summation(FeatureView<T> features) const {
     /*
     This represents the summation of activations features
     double sum = 0;
-    const auto* current = root_.get();
+    const auto* current = root_;
     // Start at the root node and walk down the tree until we reach a leaf.
     while (!current->leaf()) {
       sum += current->activation(features);
@@ -102,14 +178,204 @@ class DecisionTree {
     return walk(features)->index();
   }
 
+  // The root node, or nullptr if the tree has not been trained.
+  const Node* root() const { return root_; }
+
   int depth() const { return depth_; }
 
+  int max_depth() const { return max_depth_; }
+
+  int leaf_threshold() const { return leaf_threshold_; }
+
  private:
-  std::unique_ptr<DecisionNode<SplitterFn>> root_;
+  // Nodes with fewer samples than this grow both of their subtrees on the
+  // same thread.  Below it, a subtree takes too little time to be worth a
+  // task.
+  static constexpr std::ptrdiff_t kMinTaskSamples = 1024;
+
+  // Partition the samples so that all LEFT examples are before all RIGHT
+  // examples, and return the first RIGHT example.
+  template <typename DataSetT>
+  static SDIter partition(const Node& node,
+                          const TrainingData<T, DataSetT>& training,
+                          SDIter first, SDIter last) {
+    const auto goes_left = [&](SampleIndex sample) {
+      return node.split_direction(training.data_set.features.row(sample)) ==
+             SplitDirection::LEFT;
+    };
+    // Presorted range lookups need the samples of each node in increasing
+    // order, which a stable partition of a sorted sample preserves.
+    return training.presorted != nullptr
+               ? std::stable_partition(first, last, goes_left)
+               : std::partition(first, last, goes_left);
+  }
+
+  // Like train_recurse, but the left subtree of a large node is grown as a
+  // task on the thread pool while this thread grows the right one.  Leaves are
+  // left unnumbered, and the depth of the deepest one is returned rather than
+  // recorded, since other tasks are growing the same tree.
+  template <typename DataSetT>
+  int train_parallel(Node* current, const TrainingData<T, DataSetT>& training,
+                     SDIter first, SDIter last, int current_depth,
+                     qp::threading::Threadpool* thread_pool) {
+    current->train(training, first, last, leaf_threshold_);
+
+    if (current->leaf() || current_depth == max_depth_) {
+      current->make_leaf();
+      return current_depth;
+    }
+
+    const auto pivot_iter = partition(*current, training, first, last);
+    auto* left = make_child(current, SplitDirection::LEFT);
+    auto* right = make_child(current, SplitDirection::RIGHT);
+    if (last - first < kMinTaskSamples) {
+      return std::max(train_parallel(left, training, first, pivot_iter,
+                                     current_depth + 1, thread_pool),
+                      train_parallel(right, training, pivot_iter, last,
+                                     current_depth + 1, thread_pool));
+    }
+
+    auto left_depth = thread_pool->add([&, left, first, pivot_iter]() {
+      return train_parallel(left, training, first, pivot_iter,
+                            current_depth + 1, thread_pool);
+    });
+    const auto right_depth = train_parallel(right, training, pivot_iter, last,
+                                            current_depth + 1, thread_pool);
+    // Waiting on the pool runs other tasks meanwhile, so trees waiting on
+    // their subtrees never leave the pool without a thread to run them.
+    return std::max(thread_pool->wait(left_depth), right_depth);
+  }
+
+  // A node of the level being trained, and the samples it was trained on.
+  struct LevelNode {
+    Node* node;
+    std::size_t first;
+    std::size_t last;
+    // The number of its samples the node sent LEFT, once it has split.
+    std::size_t n_left = 0;
+  };
+
+  // Grows the tree a level at a time.  The samples of every node of a level
+  // lie next to each other, in the order of the nodes, so training the level
+  // sweeps the sample in order.  As each node is trained it marks the
+  // direction of each of its samples, and then a single pass moves the
+  // samples of the whole level into a second buffer, in the order of the
+  // next level.  This keeps each child's samples in their original order,
+  // as presorted range lookups need.
+  template <typename DataSetT>
+  void train_level_wise(const TrainingData<T, DataSetT>& training,
+                        SampledDataSet& sample,
+                        qp::threading::Threadpool* thread_pool) {
+    std::vector<LevelNode> level = {{root_, 0, sample.size()}};
+    SampledDataSet next(sample.size());
+    std::vector<std::uint8_t> goes_left(sample.size());
+
+    for (int depth = 0; !level.empty(); ++depth) {
+      record_depth(depth);
+      for_each_level_node(level, thread_pool, [&](LevelNode& current) {
+        auto* node = current.node;
+        const auto first = sample.begin() + current.first;
+        const auto last = sample.begin() + current.last;
+        node->train(training, first, last, leaf_threshold_);
+        if (node->leaf() || depth == max_depth_) {
+          node->make_leaf();
+          return;
+        }
+        for (auto i = current.first; i < current.last; ++i) {
+          goes_left[i] = node->split_direction(training.data_set.features.row(
+                             sample[i])) == SplitDirection::LEFT;
+          current.n_left += goes_left[i];
+        }
+      });
+
+      // Each node's samples stay where they are, so the children of a node
+      // take its place in the next level.  The samples of leaves are copied
+      // as well, leaving both buffers a reordering of the sample.
+      for_each_level_node(level, thread_pool, [&](LevelNode& current) {
+        if (current.node->leaf()) {
+          std::copy(sample.begin() + current.first,
+                    sample.begin() + current.last,
+                    next.begin() + current.first);
+          return;
+        }
+        auto left = current.first;
+        auto right = current.first + current.n_left;
+        for (auto i = current.first; i < current.last; ++i) {
+          next[goes_left[i] ? left++ : right++] = sample[i];
+        }
+      });
+      sample.swap(next);
+
+      std::vector<LevelNode> children;
+      for (const auto& current : level) {
+        if (current.node->leaf()) continue;
+        const auto pivot = current.first + current.n_left;
+        children.push_back({make_child(current.node, SplitDirection::LEFT),
+                            current.first, pivot});
+        children.push_back({make_child(current.node, SplitDirection::RIGHT),
+                            pivot, current.last});
+      }
+      level = std::move(children);
+    }
+  }
+
+  // Calls f on every node of the level.  Given a thread pool, runs of
+  // consecutive nodes with enough samples between them are handed to it as
+  // tasks.
+  template <typename F>
+  static void for_each_level_node(std::vector<LevelNode>& level,
+                                  qp::threading::Threadpool* thread_pool,
+                                  F&& f) {
+    if (thread_pool == nullptr) {
+      for (auto& current : level) f(current);
+      return;
+    }
+
+    // A few tasks per thread evens out nodes which take longer than others.
+    const auto n_samples = level.back().last - level.front().first;
+    const auto task_samples =
+        std::max<std::size_t>(n_samples / (4 * thread_pool->n_threads()),
+                              kMinTaskSamples);
+    std::vector<std::future<void>> futures;
+    for (auto begin = level.begin(); begin != level.end();) {
+      auto end = begin;
+      auto samples = 0ul;
+      while (end != level.end() && samples < task_samples) {
+        samples += end->last - end->first;
+        ++end;
+      }
+      futures.emplace_back(thread_pool->add([&f, begin, end]() {
+        for (auto current = begin; current != end; ++current) f(*current);
+      }));
+      begin = end;
+    }
+    for (auto& future : futures) thread_pool->wait(future);
+  }
+
+  // Frees every node and replaces them with a single untrained root.
+  void reset_nodes() {
+    nodes_.clear();
+    root_ = nodes_.make();
+  }
+
+  // Numbers the leaves under node in depth first order, left before right.
+  void index_leaves(Node* node) {
+    if (node->leaf()) {
+      finish_leaf(node);
+      return;
+    }
+    index_leaves(node->get_child(SplitDirection::LEFT));
+    index_leaves(node->get_child(SplitDirection::RIGHT));
+  }
+
+  // Every node of the tree, in the order they were made.
+  NodeArena<Node> nodes_;
+  Node* root_ = nullptr;
   int max_depth_;
   int depth_;
   int leaf_threshold_;
   TreeType type_;
+  TreeGrowth growth_;
   int n_leaves_;
 };
 
@@ -8,24 +8,28 @@ namespace qp {
 namespace rf {
 
 // Add an element to each entry in a vector.
-void vector_plus(std::vector<double>& vec, const double v) {
+template <typename T, typename U>
+void vector_plus(std::vector<T>& vec, const U v) {
   for (auto& e : vec) e += v;
 }
 
 // Subtract an element from each entry in a vector.
-void vector_minus(std::vector<double>& vec, const double v) {
+template <typename T, typename U>
+void vector_minus(std::vector<T>& vec, const U v) {
   for (auto& e : vec) e -= v;
 }
 
 // Element wise minus of dst[i] - src[i].
-void vector_minus(std::vector<double>& dst, const std::vector<double>& src) {
+template <typename T, typename U>
+void vector_minus(std::vector<T>& dst, const std::vector<U>& src) {
   for (std::size_t i = 0; i < std::min(dst.size(), src.size()); ++i) {
     dst[i] -= src[i];
   }
 }
 
 // Element wise plus of dst[i] - src[i].
-void vector_plus(std::vector<double>& dst, const std::vector<double>& src) {
+template <typename T, typename U>
+void vector_plus(std::vector<T>& dst, const std::vector<U>& src) {
   for (std::size_t i = 0; i < std::min(dst.size(), src.size()); ++i) {
     dst[i] += src[i];
   }
@@ -36,17 +40,19 @@ void generate_back_n(Container& c, std::size_t n, const Generator& g) {
   std::generate_n(std::back_inserter(c), n, g);
 }
 
-template <typename T, typename Iter>
-void project(const std::vector<T>& v, const std::vector<std::size_t>& indices,
+// Copies the entries of v at the given indices to out.  Works with anything
+// which can be indexed, such as vectors or feature views.
+template <typename Vec, typename Iter>
+void project(const Vec& v, const std::vector<std::size_t>& indices,
              Iter out) {
   std::transform(indices.begin(), indices.end(), out,
                  [&v](const std::size_t i) { return v[i]; });
 }
 
-template <typename T>
-std::vector<T> project(const std::vector<T>& v,
-                       const std::vector<std::size_t>& indicies) {
-  std::vector<T> ret(indicies.size());
+template <typename Vec>
+std::vector<typename Vec::value_type> project(
+    const Vec& v, const std::vector<std::size_t>& indicies) {
+  std::vector<typename Vec::value_type> ret(indicies.size());
   project(v, indicies, ret.begin());
   return ret;
 }